@@ -0,0 +1,314 @@
+
+/*
+ * Event timer microbenchmark: the rbtree and the timing wheel.
+ *
+ * The timer code is compiled in as is, once per method, see misc/GNUmakefile.
+ * Each event stands for a connection: most timers are read and keepalive
+ * timeouts that are moved on activity and seldom expire, a few are short
+ * ones that do.  Before the runs, lone timers near the spans of the wheel
+ * levels are checked to be found and expired in time.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+#include "../src/core/ngx_rbtree.c"
+#include "../src/event/ngx_event_timer.c"
+
+
+#if (NGX_TIMER_WHEEL)
+#define NGX_TIMER_BENCH_METHOD  "wheel"
+#else
+#define NGX_TIMER_BENCH_METHOD  "rbtree"
+#endif
+
+
+typedef struct {
+    ngx_msec_t   timeout;
+    ngx_uint_t   percent;
+    ngx_uint_t   spread;
+} ngx_timer_bench_mix_t;
+
+
+static ngx_timer_bench_mix_t  ngx_timer_bench_mix[] = {
+    { 60000, 60, 0 },           /* proxy_read_timeout, client_body_timeout */
+    { 75000, 25, 0 },           /* keepalive_timeout */
+    { 1000, 10, 4000 },         /* resolver, lingering close */
+    { 10, 5, 490 },             /* limit_req delays, aio retries */
+    { 0, 0, 0 }
+};
+
+
+volatile ngx_msec_t  ngx_current_msec;
+
+static uint64_t      ngx_timer_bench_rnd = 0x9e3779b97f4a7c15;
+static ngx_uint_t    ngx_timer_bench_expired;
+static ngx_msec_t    ngx_timer_bench_fired;
+
+
+static uint64_t
+ngx_timer_bench_random(void)
+{
+    /* xorshift64*, the runs of both methods see the same sequence */
+
+    ngx_timer_bench_rnd ^= ngx_timer_bench_rnd >> 12;
+    ngx_timer_bench_rnd ^= ngx_timer_bench_rnd << 25;
+    ngx_timer_bench_rnd ^= ngx_timer_bench_rnd >> 27;
+
+    return ngx_timer_bench_rnd * 0x2545f4914f6cdd1d;
+}
+
+
+static ngx_msec_t
+ngx_timer_bench_timeout(void)
+{
+    ngx_uint_t              n;
+    ngx_timer_bench_mix_t  *mix;
+
+    n = ngx_timer_bench_random() % 100;
+
+    for (mix = ngx_timer_bench_mix; mix->percent; mix++) {
+        if (n < mix->percent) {
+            break;
+        }
+
+        n -= mix->percent;
+    }
+
+    if (mix->spread == 0) {
+        return mix->timeout;
+    }
+
+    return mix->timeout + ngx_timer_bench_random() % mix->spread;
+}
+
+
+static void
+ngx_timer_bench_handler(ngx_event_t *ev)
+{
+    ngx_timer_bench_expired++;
+
+    /* the connection lives on, e.g. the next keepalive request */
+
+    if (ev->data) {
+        ngx_add_timer(ev, ngx_timer_bench_timeout());
+    }
+}
+
+
+static void
+ngx_timer_bench_check_handler(ngx_event_t *ev)
+{
+    ngx_timer_bench_fired = ngx_current_msec;
+}
+
+
+static ngx_int_t
+ngx_timer_bench_check(void)
+{
+    ngx_uint_t   i, k, loops;
+    ngx_msec_t   timer, key;
+    ngx_event_t  ev;
+
+    /*
+     * a lone timer is run by the event loop alone, it has to be found and
+     * expired in time, with the wheel time near the end of a round of a
+     * level and the timeout near the span of a level
+     */
+
+    static ngx_msec_t  now[] = {
+        0, 1, 255, 256, 65280, 65535, 65536, 16777215, 0xfffffff0
+    };
+
+    static ngx_msec_t  delta[] = {
+        1, 255, 256, 257, 65279, 65280, 65535, 65536, 65537,
+        16777215, 16777216, 16777217
+    };
+
+    for (i = 0; i < sizeof(now) / sizeof(now[0]); i++) {
+        for (k = 0; k < sizeof(delta) / sizeof(delta[0]); k++) {
+
+            ngx_memzero(&ev, sizeof(ngx_event_t));
+            ev.handler = ngx_timer_bench_check_handler;
+
+            ngx_current_msec = now[i];
+            (void) ngx_event_timer_init(NULL);
+
+            ngx_add_timer(&ev, delta[k]);
+            key = now[i] + delta[k];
+
+            ngx_timer_bench_fired = 0;
+
+            for (loops = 0; ev.timer_set && loops < 1000; loops++) {
+                timer = ngx_event_find_timer();
+
+                if (timer == NGX_TIMER_INFINITE) {
+                    break;
+                }
+
+                ngx_current_msec += timer ? timer : 1;
+
+                ngx_event_expire_timers();
+            }
+
+            if (ev.timer_set || ngx_timer_bench_fired != key) {
+                fprintf(stderr, "%s: timer of %lu ms at %lu: %s %lu\n",
+                        NGX_TIMER_BENCH_METHOD, (unsigned long) delta[k],
+                        (unsigned long) now[i],
+                        ev.timer_set ? "not expired, now" : "expired at",
+                        (unsigned long) (ev.timer_set ? ngx_current_msec
+                                                      : ngx_timer_bench_fired));
+                return NGX_ERROR;
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static uint64_t
+ngx_timer_bench_nsec(void)
+{
+    struct timespec  ts;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static void
+ngx_timer_bench_report(const char *name, uint64_t start, ngx_uint_t ops)
+{
+    uint64_t  nsec;
+
+    nsec = ngx_timer_bench_nsec() - start;
+
+    printf("%-7s %-8s %10lu ops %12.1f ns/op\n",
+           NGX_TIMER_BENCH_METHOD, name, (unsigned long) ops,
+           ops ? (double) nsec / ops : 0.0);
+}
+
+
+int
+main(int argc, char *const *argv)
+{
+    uint64_t      start;
+    ngx_msec_t    timer;
+    ngx_uint_t    i, k, n, ticks, active, ops;
+    ngx_event_t  *events, *ev;
+
+    n = (argc > 1) ? (ngx_uint_t) atoi(argv[1]) : 100000;
+    ticks = (argc > 2) ? (ngx_uint_t) atoi(argv[2]) : 10000;
+
+    if (n == 0) {
+        fprintf(stderr, "usage: %s [timers [msec]]\n", argv[0]);
+        return 1;
+    }
+
+    /* about a percent of the connections is active every millisecond */
+
+    active = n / 100 + 1;
+
+    events = calloc(n, sizeof(ngx_event_t));
+    if (events == NULL) {
+        return 1;
+    }
+
+    if (ngx_timer_bench_check() != NGX_OK) {
+        return 1;
+    }
+
+    for (i = 0; i < n; i++) {
+        events[i].handler = ngx_timer_bench_handler;
+    }
+
+    ngx_current_msec = 1000000;
+
+    (void) ngx_event_timer_init(NULL);
+
+    /* insert: the timers of new connections */
+
+    start = ngx_timer_bench_nsec();
+
+    for (i = 0; i < n; i++) {
+        ngx_add_timer(&events[i], ngx_timer_bench_timeout());
+    }
+
+    ngx_timer_bench_report("insert", start, n);
+
+    /* delete: the connections are closed before their timers expire */
+
+    start = ngx_timer_bench_nsec();
+
+    for (i = 0; i < n; i++) {
+        ngx_del_timer(&events[i]);
+    }
+
+    ngx_timer_bench_report("delete", start, n);
+
+    /*
+     * steady: every millisecond some connections move their timers on,
+     * the event loop looks for the nearest timer and expires the due ones,
+     * which are rearmed
+     */
+
+    for (i = 0; i < n; i++) {
+        events[i].data = &events[i];
+        ngx_add_timer(&events[i], ngx_timer_bench_timeout());
+    }
+
+    ngx_timer_bench_expired = 0;
+    ops = 0;
+
+    start = ngx_timer_bench_nsec();
+
+    for (i = 0; i < ticks; i++) {
+        ngx_current_msec++;
+
+        for (k = 0; k < active; k++) {
+            ev = &events[ngx_timer_bench_random() % n];
+            ngx_add_timer(ev, ngx_timer_bench_timeout());
+        }
+
+        ops += active;
+
+        (void) ngx_event_find_timer();
+        ngx_event_expire_timers();
+    }
+
+    ngx_timer_bench_report("steady", start, ops + ngx_timer_bench_expired);
+
+    printf("%-7s %-8s %10lu expired in %lu msec\n",
+           NGX_TIMER_BENCH_METHOD, "", (unsigned long) ngx_timer_bench_expired,
+           (unsigned long) ticks);
+
+    /* expire: all the timers run out, e.g. the upstream went away */
+
+    for (i = 0; i < n; i++) {
+        events[i].data = NULL;
+    }
+
+    ngx_timer_bench_expired = 0;
+
+    start = ngx_timer_bench_nsec();
+
+    while (!ngx_event_timer_empty()) {
+
+        /* the event loop sleeps until the nearest timer */
+
+        timer = ngx_event_find_timer();
+        ngx_current_msec += timer ? timer : 1;
+
+        ngx_event_expire_timers();
+    }
+
+    ngx_timer_bench_report("expire", start, ngx_timer_bench_expired);
+
+    free(events);
+
+    return 0;
+}
@@ -4,17 +4,56 @@
 
 #include <librdkafka/rdkafka.h>
 #include <hiredis/hiredis.h>
+#include <hiredis/async.h>
+
+#define NGX_HTTP_KAFKA_REDIS_FAIL_OPEN    0
+#define NGX_HTTP_KAFKA_REDIS_FAIL_CLOSED  1
+
+#define NGX_HTTP_KAFKA_LATENCY_BUCKETS    9
+
+typedef struct ngx_http_kafka_ctx_s  ngx_http_kafka_ctx_t;
 
 static ngx_int_t ngx_http_kafka_init_worker(ngx_cycle_t *cycle);
 static void ngx_http_kafka_exit_worker(ngx_cycle_t *cycle);
 
 static void *ngx_http_kafka_create_main_conf(ngx_conf_t *cf);
 static void *ngx_http_kafka_create_loc_conf(ngx_conf_t *cf);
+static char *ngx_http_kafka_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child);
 static char *ngx_http_set_kafka_topic(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_http_set_kafka_broker(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_http_set_redis_host(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static ngx_int_t ngx_http_kafka_handler(ngx_http_request_t *r);
 static void ngx_http_kafka_post_callback_handler(ngx_http_request_t *r);
+static void ngx_http_kafka_produce_and_respond(ngx_http_request_t *r, ngx_uint_t produce);
+static void ngx_http_kafka_finalize(ngx_http_request_t *r, ngx_http_kafka_ctx_t *ctx,
+                                    ngx_int_t rc);
+static ngx_int_t ngx_http_kafka_produce_body(ngx_http_request_t *r, ngx_http_kafka_ctx_t *ctx);
+static ngx_int_t ngx_http_kafka_produce_records(ngx_http_request_t *r,
+                                                ngx_http_kafka_ctx_t *ctx);
+static ngx_int_t ngx_http_kafka_scan_records(ngx_http_request_t *r,
+                                             ngx_http_kafka_ctx_t *ctx,
+                                             u_char *p, u_char *end, int flags);
+static ngx_int_t ngx_http_kafka_produce_record(ngx_http_request_t *r, ngx_http_kafka_ctx_t *ctx,
+                                               u_char *start, u_char *end, int flags);
+static ngx_int_t ngx_http_kafka_produce(ngx_http_request_t *r, ngx_http_kafka_ctx_t *ctx,
+                                        u_char *msg, size_t len, int flags);
+#if (NGX_THREADS)
+static ngx_int_t ngx_http_kafka_thread_handler(ngx_thread_task_t *task, ngx_file_t *file);
+static void ngx_http_kafka_thread_event_handler(ngx_event_t *ev);
+#endif
+
+static void ngx_http_kafka_poll_handler(ngx_event_t *ev);
+
+static char *ngx_http_kafka_stats_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static ngx_int_t ngx_http_kafka_init_zone(ngx_shm_zone_t *shm_zone, void *data);
+static char *ngx_http_kafka_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static ngx_int_t ngx_http_kafka_status_handler(ngx_http_request_t *r);
+
+static ngx_int_t ngx_http_kafka_redis_check(ngx_http_request_t *r);
+static void ngx_http_kafka_redis_reply(redisAsyncContext *ac, void *reply, void *privdata);
+static void ngx_http_kafka_redis_timeout(ngx_event_t *ev);
+static void ngx_http_kafka_redis_done(ngx_http_request_t *r, ngx_int_t rc);
+static void ngx_http_kafka_redis_detach(void *data);
 
 typedef enum {
     ngx_str_push = 0,
@@ -23,11 +62,58 @@ typedef enum {
 
 static void ngx_str_helper(ngx_str_t *str, ngx_str_op op);
 
+/* messages a worker has handed to librdkafka and not yet seen delivered */
+typedef struct {
+    ngx_atomic_t      queued;
+    ngx_atomic_t      queued_bytes;
+} ngx_http_kafka_gauge_t;
+
+/* per topic counters, shared by all workers */
+typedef struct {
+    ngx_queue_t       queue;
+    
+    ngx_atomic_t      produced;
+    ngx_atomic_t      failed;
+    ngx_atomic_t      rejected;
+    
+    /* delivery latency, see ngx_http_kafka_latency_bounds */
+    ngx_atomic_t      latency[NGX_HTTP_KAFKA_LATENCY_BUCKETS];
+    
+    /*
+     * indexed by ngx_process_slot: the messages of a worker that died
+     * are never delivered, so a worker starts its own slot over
+     */
+    ngx_http_kafka_gauge_t  gauge[NGX_MAX_PROCESSES];
+    
+    size_t            len;
+    u_char            name[1];
+} ngx_http_kafka_stats_node_t;
+
+typedef struct {
+    ngx_queue_t       topics;
+} ngx_http_kafka_stats_sh_t;
+
+static ngx_msec_t ngx_http_kafka_latency_bounds[NGX_HTTP_KAFKA_LATENCY_BUCKETS - 1] = {
+    1, 5, 10, 50, 100, 500, 1000, 5000
+};
+
 typedef struct {
     rd_kafka_t       *rk;
     rd_kafka_conf_t  *rkc;
     
-    struct redisContext *redis_ctx;
+    ngx_shm_zone_t             *stats_zone;
+    ngx_slab_pool_t            *shpool;
+    ngx_http_kafka_stats_sh_t  *sh;
+    
+    ngx_int_t         batch_size;
+    ngx_msec_t        linger;
+    ngx_msec_t        poll_interval;
+    
+    /* per worker, driven by the nginx event loop */
+    redisAsyncContext  *redis_actx;
+    u_char             *redis_addr;
+    in_port_t           redis_port;
+    ngx_uint_t          redis_pending;
     
     size_t         broker_size;
     size_t         nbrokers;
@@ -37,6 +123,8 @@ typedef struct {
 
 static void ngx_http_kafka_main_conf_broker_add(ngx_http_kafka_main_conf_t *cf,
                                                 ngx_str_t *broker, ngx_pool_t *pool);
+static redisAsyncContext *ngx_http_kafka_redis_connect(ngx_http_kafka_main_conf_t *mcf,
+                                                       ngx_log_t *log);
 
 typedef struct {
     ngx_str_t topic;
@@ -44,11 +132,91 @@ typedef struct {
     
     ngx_flag_t redis_flag;
     ngx_str_t redis_host;
+    ngx_msec_t redis_timeout;
+    ngx_uint_t redis_fail;
+    ngx_int_t redis_max_pending;
+    
+    ngx_flag_t zero_copy;
+    size_t chunk_size;
+    ngx_flag_t split;
+    
+    /* keep related messages in one partition, e.g. by $arg_uid */
+    ngx_http_complex_value_t *key;
+    ngx_http_complex_value_t *partition;
+    
+    ngx_int_t queue_high_water;
+    ngx_uint_t overload_status;
+    
+    ngx_http_kafka_stats_node_t  *stats;
     
     rd_kafka_topic_t       *rkt;
     rd_kafka_topic_conf_t  *rktc;
 } ngx_http_kafka_loc_conf_t;
 
+static ngx_http_kafka_stats_node_t *ngx_http_kafka_stats_node(ngx_http_request_t *r);
+
+/*
+ * A pending redis check outlives the request when the timeout fires first
+ * or the request is freed: the reply callback then only frees it.
+ */
+typedef struct {
+    ngx_http_request_t  *request;
+    ngx_pool_cleanup_t  *cleanup;
+    ngx_event_t          timer;
+} ngx_http_kafka_redis_check_t;
+
+/*
+ * With kafka_zero_copy the payload points into the request body, so the
+ * request is held (r->main->count) until every message is delivered.
+ */
+struct ngx_http_kafka_ctx_s {
+    ngx_http_request_t  *request;
+    ngx_uint_t           pending;
+    
+    ngx_str_t            key;
+    int32_t              partition;
+    
+    /* the part of the body not produced yet */
+    ngx_chain_t         *in;
+    off_t                rest;
+    
+    /* the message being joined, with kafka_split the record so far */
+    u_char              *msg;
+    u_char              *last;
+    size_t               size;
+    int                  flags;
+    
+    /* kafka_split: a temp file chunk being scanned */
+    u_char              *chunk;
+    
+    /* kafka_split: the lines of the body produced so far, blank ones too */
+    ngx_uint_t           lines;
+
+#if (NGX_THREADS)
+    ngx_thread_task_t   *thread_task;
+#endif
+};
+
+/*
+ * Delivery report opaque: it is allocated when the message has to be
+ * accounted for and may outlive the request unless ctx holds it.
+ */
+typedef struct {
+    ngx_http_kafka_ctx_t         *ctx;
+    ngx_http_kafka_stats_node_t  *stats;
+    ngx_msec_t                    start;
+    size_t                        len;
+} ngx_http_kafka_msg_t;
+
+static ngx_event_t  ngx_http_kafka_poll_event;
+static ngx_uint_t   ngx_http_kafka_exiting;
+
+static ngx_conf_enum_t ngx_http_kafka_redis_fail[] = {
+    { ngx_string("open"), NGX_HTTP_KAFKA_REDIS_FAIL_OPEN },
+    { ngx_string("closed"), NGX_HTTP_KAFKA_REDIS_FAIL_CLOSED },
+    { ngx_null_string, 0 }
+};
+
 static ngx_command_t ngx_http_kafka_commands[] = {
     {
         ngx_string("kafka_topic"),
@@ -64,6 +232,102 @@ static ngx_command_t ngx_http_kafka_commands[] = {
         NGX_HTTP_LOC_CONF_OFFSET,
         offsetof(ngx_http_kafka_loc_conf_t, broker),
         NULL },
+    {
+        ngx_string("kafka_batch_size"),
+        NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_num_slot,
+        NGX_HTTP_MAIN_CONF_OFFSET,
+        offsetof(ngx_http_kafka_main_conf_t, batch_size),
+        NULL
+    },
+    {
+        ngx_string("kafka_linger_ms"),
+        NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_msec_slot,
+        NGX_HTTP_MAIN_CONF_OFFSET,
+        offsetof(ngx_http_kafka_main_conf_t, linger),
+        NULL
+    },
+    {
+        ngx_string("kafka_poll_interval"),
+        NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_msec_slot,
+        NGX_HTTP_MAIN_CONF_OFFSET,
+        offsetof(ngx_http_kafka_main_conf_t, poll_interval),
+        NULL
+    },
+    {
+        ngx_string("kafka_zero_copy"),
+        NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+        ngx_conf_set_flag_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_kafka_loc_conf_t, zero_copy),
+        NULL
+    },
+    {
+        ngx_string("kafka_chunk_size"),
+        NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_size_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_kafka_loc_conf_t, chunk_size),
+        NULL
+    },
+    {
+        ngx_string("kafka_split"),
+        NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+        ngx_conf_set_flag_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_kafka_loc_conf_t, split),
+        NULL
+    },
+    {
+        ngx_string("kafka_key"),
+        NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+        ngx_http_set_complex_value_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_kafka_loc_conf_t, key),
+        NULL
+    },
+    {
+        ngx_string("kafka_partition"),
+        NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+        ngx_http_set_complex_value_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_kafka_loc_conf_t, partition),
+        NULL
+    },
+    {
+        ngx_string("kafka_queue_high_water"),
+        NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_num_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_kafka_loc_conf_t, queue_high_water),
+        NULL
+    },
+    {
+        ngx_string("kafka_overload_status"),
+        NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_num_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_kafka_loc_conf_t, overload_status),
+        NULL
+    },
+    {
+        ngx_string("kafka_stats_zone"),
+        NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE2,
+        ngx_http_kafka_stats_zone,
+        NGX_HTTP_MAIN_CONF_OFFSET,
+        0,
+        NULL
+    },
+    {
+        ngx_string("kafka_status"),
+        NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+        ngx_http_kafka_status,
+        0,
+        0,
+        NULL
+    },
     {
         ngx_string("redis_host"),
         NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
@@ -79,6 +343,30 @@ static ngx_command_t ngx_http_kafka_commands[] = {
         offsetof(ngx_http_kafka_loc_conf_t, redis_flag),
         NULL
     },
+    {
+        ngx_string("redis_timeout"),
+        NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_msec_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_kafka_loc_conf_t, redis_timeout),
+        NULL
+    },
+    {
+        ngx_string("redis_fail"),
+        NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_enum_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_kafka_loc_conf_t, redis_fail),
+        &ngx_http_kafka_redis_fail
+    },
+    {
+        ngx_string("redis_max_pending"),
+        NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_num_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_kafka_loc_conf_t, redis_max_pending),
+        NULL
+    },
     ngx_null_command
 };
 
@@ -95,7 +383,8 @@ static ngx_http_module_t ngx_http_kafka_module_ctx = {
     
     /* create local conf */
     ngx_http_kafka_create_loc_conf,
-    NULL,      /* merge location conf */
+    /* merge location conf */
+    ngx_http_kafka_merge_loc_conf,
 };
 
 ngx_module_t ngx_http_kafka_module = {
@@ -117,7 +406,7 @@ ngx_module_t ngx_http_kafka_module = {
 
 ngx_int_t ngx_str_equal(ngx_str_t *s1, ngx_str_t *s2)
 {
-    if (s1->len != s1->len) {
+    if (s1->len != s2->len) {
         return 0;
     }
     if (ngx_memcmp(s1->data, s2->data, s1->len) != 0) {
@@ -181,6 +470,13 @@ void *ngx_http_kafka_create_main_conf(ngx_conf_t *cf)
     conf->rk = NULL;
     conf->rkc = NULL;
     
+    conf->batch_size = NGX_CONF_UNSET;
+    conf->linger = NGX_CONF_UNSET_MSEC;
+    conf->poll_interval = NGX_CONF_UNSET_MSEC;
+    
+    conf->redis_actx = NULL;
+    conf->redis_addr = NULL;
+    
     conf->broker_size = 0;
     conf->nbrokers = 0;
     conf->brokers = NULL;
@@ -200,14 +496,125 @@ void *ngx_http_kafka_create_loc_conf(ngx_conf_t *cf)
     ngx_str_null(&conf->broker);
     ngx_str_null(&conf->redis_host);
     conf->redis_flag = NGX_CONF_UNSET;
+    conf->redis_timeout = NGX_CONF_UNSET_MSEC;
+    conf->redis_fail = NGX_CONF_UNSET_UINT;
+    conf->redis_max_pending = NGX_CONF_UNSET;
+    conf->zero_copy = NGX_CONF_UNSET;
+    conf->chunk_size = NGX_CONF_UNSET_SIZE;
+    conf->split = NGX_CONF_UNSET;
+    conf->queue_high_water = NGX_CONF_UNSET;
+    conf->overload_status = NGX_CONF_UNSET_UINT;
     return conf;
 }
 
-void kafka_callback_handler(rd_kafka_t *rk, void *msg, size_t len, int err, void *opaque, void *msg_opaque)
+char *ngx_http_kafka_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_kafka_loc_conf_t  *prev = parent;
+    ngx_http_kafka_loc_conf_t  *conf = child;
+    
+    ngx_conf_merge_value(conf->redis_flag, prev->redis_flag, 0);
+    ngx_conf_merge_msec_value(conf->redis_timeout, prev->redis_timeout, 50);
+    ngx_conf_merge_uint_value(conf->redis_fail, prev->redis_fail,
+                              NGX_HTTP_KAFKA_REDIS_FAIL_OPEN);
+    ngx_conf_merge_value(conf->redis_max_pending, prev->redis_max_pending, 1024);
+    ngx_conf_merge_value(conf->zero_copy, prev->zero_copy, 0);
+    ngx_conf_merge_size_value(conf->chunk_size, prev->chunk_size, 0);
+    ngx_conf_merge_value(conf->split, prev->split, 0);
+    
+    if (conf->key == NULL) {
+        conf->key = prev->key;
+    }
+    
+    if (conf->partition == NULL) {
+        conf->partition = prev->partition;
+    }
+    
+    ngx_conf_merge_value(conf->queue_high_water, prev->queue_high_water, 0);
+    ngx_conf_merge_uint_value(conf->overload_status, prev->overload_status,
+                              NGX_HTTP_SERVICE_UNAVAILABLE);
+    
+    if (conf->overload_status < NGX_HTTP_BAD_REQUEST || conf->overload_status > 599) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "value \"%ui\" must be between 400 and 599",
+                           conf->overload_status);
+        return NGX_CONF_ERROR;
+    }
+    
+    return NGX_CONF_OK;
+}
+
+void kafka_callback_handler(rd_kafka_t *rk, void *msg, size_t len, rd_kafka_resp_err_t err,
+                            void *opaque, void *msg_opaque)
 {
+    ngx_uint_t                    i;
+    ngx_msec_t                    latency;
+    ngx_log_t                    *log;
+    ngx_connection_t             *c;
+    ngx_http_request_t           *r;
+    ngx_http_kafka_ctx_t         *ctx;
+    ngx_http_kafka_msg_t         *m = msg_opaque;
+    ngx_http_kafka_gauge_t       *gauge;
+    ngx_http_kafka_stats_node_t  *stats;
+    
+    if (m == NULL) {
+        if (err != 0) {
+            ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                          "kafka delivery failed: %s", rd_kafka_err2str(err));
+        }
+        return;
+    }
+    
+    ctx = m->ctx;
+    stats = m->stats;
+    
+    log = ctx ? ctx->request->connection->log : ngx_cycle->log;
+    
     if (err != 0) {
-        ngx_log_error(NGX_LOG_ERR, (ngx_log_t *)msg_opaque, 0, rd_kafka_err2str(err));
+        ngx_log_error(NGX_LOG_ERR, log, 0, "kafka delivery failed: %s",
+                      rd_kafka_err2str(err));
+    }
+    
+    if (stats) {
+        gauge = &stats->gauge[ngx_process_slot];
+        
+        (void) ngx_atomic_fetch_add(&gauge->queued, -1);
+        (void) ngx_atomic_fetch_add(&gauge->queued_bytes, -(ngx_atomic_int_t) m->len);
+        
+        if (err != 0) {
+            (void) ngx_atomic_fetch_add(&stats->failed, 1);
+            
+        } else {
+            (void) ngx_atomic_fetch_add(&stats->produced, 1);
+            
+            latency = ngx_current_msec - m->start;
+            
+            for (i = 0; i < NGX_HTTP_KAFKA_LATENCY_BUCKETS - 1; i++) {
+                if (latency <= ngx_http_kafka_latency_bounds[i]) {
+                    break;
+                }
+            }
+            
+            (void) ngx_atomic_fetch_add(&stats->latency[i], 1);
+        }
+    }
+    
+    ngx_free(m);
+    
+    if (ctx == NULL || --ctx->pending) {
+        return;
+    }
+    
+    if (ngx_http_kafka_exiting) {
+        /* the worker is going away together with the held request */
+        return;
     }
+    
+    r = ctx->request;
+    c = r->connection;
+    
+    /* release the reference taken in ngx_http_kafka_produce_and_respond() */
+    ngx_http_finalize_request(r, NGX_DONE);
+    ngx_http_run_posted_requests(c);
 }
 
 char *ngx_http_set_kafka_topic(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
@@ -252,191 +659,1442 @@ char *ngx_http_set_kafka_broker(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     return NGX_CONF_OK;
 }
 
-void ngx_http_kafka_main_conf_redis_host_add(ngx_http_kafka_main_conf_t *cf,
-                                             ngx_str_t *redis_host, ngx_pool_t *pool)
+char *ngx_http_set_redis_host(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
+    size_t                       len;
+    ngx_url_t                    u;
+    ngx_http_kafka_loc_conf_t   *local_conf;
+    ngx_http_kafka_main_conf_t  *main_conf;
     
-    int port = 6379;
-    struct timeval timeout = { 1, 500000 }; // 1.5 seconds
+    if (ngx_conf_set_str_slot(cf, cmd, conf) != NGX_CONF_OK) {
+        return NGX_CONF_ERROR;
+    }
     
-    ngx_str_helper(redis_host, ngx_str_push);
-    cf->redis_ctx = redisConnectWithTimeout((const char *)redis_host->data, port, timeout);
-    ngx_str_helper(redis_host, ngx_str_pop);
+    local_conf = conf;
     
-    if (cf->redis_ctx == NULL || cf->redis_ctx->err) {
-        if (cf->redis_ctx) {
-            printf("Connection error: %s\n", cf->redis_ctx->errstr);
-            redisFree(cf->redis_ctx);
-        } else {
-            printf("Connection error: can't allocate redis context\n");
+    main_conf = ngx_http_conf_get_module_main_conf(cf, ngx_http_kafka_module);
+    if (main_conf == NULL) {
+        return NGX_CONF_ERROR;
+    }
+    
+    /*
+     * resolve once here: hiredis would otherwise call the blocking
+     * getaddrinfo() from the worker every time it reconnects
+     */
+    
+    ngx_memzero(&u, sizeof(ngx_url_t));
+    
+    u.url = local_conf->redis_host;
+    u.default_port = 6379;
+    
+    if (ngx_parse_url(cf->pool, &u) != NGX_OK) {
+        if (u.err) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "%s in redis host \"%V\"", u.err, &u.url);
         }
-        return;
+        return NGX_CONF_ERROR;
+    }
+    
+    main_conf->redis_addr = ngx_pnalloc(cf->pool, NGX_SOCKADDR_STRLEN + 1);
+    if (main_conf->redis_addr == NULL) {
+        return NGX_CONF_ERROR;
     }
     
+    len = ngx_sock_ntop(u.addrs[0].sockaddr, u.addrs[0].socklen,
+                        main_conf->redis_addr, NGX_SOCKADDR_STRLEN, 0);
+    main_conf->redis_addr[len] = '\0';
+    main_conf->redis_port = u.port;
+    
+    return NGX_CONF_OK;
 }
 
-char *ngx_http_set_redis_host(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+char *ngx_http_kafka_stats_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
-    ngx_http_kafka_loc_conf_t  *local_conf;
-    ngx_http_kafka_main_conf_t *main_conf;
+    ssize_t                      size;
+    ngx_str_t                   *value;
+    ngx_http_kafka_main_conf_t  *main_conf = conf;
     
-    if (ngx_conf_set_str_slot(cf, cmd, conf) != NGX_CONF_OK) {
+    if (main_conf->stats_zone) {
+        return "is duplicate";
+    }
+    
+    value = cf->args->elts;
+    
+    size = ngx_parse_size(&value[2]);
+    
+    if (size == NGX_ERROR || size < (ssize_t) (8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone size \"%V\"", &value[2]);
         return NGX_CONF_ERROR;
     }
     
-    local_conf = conf;
+    main_conf->stats_zone = ngx_shared_memory_add(cf, &value[1], size,
+                                                  &ngx_http_kafka_module);
+    if (main_conf->stats_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
     
-    main_conf = ngx_http_conf_get_module_main_conf(cf, ngx_http_kafka_module);
-    if (main_conf == NULL) {
+    if (main_conf->stats_zone->data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "zone \"%V\" is already used", &value[1]);
         return NGX_CONF_ERROR;
     }
-    ngx_http_kafka_main_conf_redis_host_add(main_conf, &local_conf->redis_host, cf->pool);
+    
+    main_conf->stats_zone->init = ngx_http_kafka_init_zone;
+    main_conf->stats_zone->data = main_conf;
     
     return NGX_CONF_OK;
 }
 
-static ngx_int_t ngx_http_kafka_handler(ngx_http_request_t *r)
+static ngx_int_t ngx_http_kafka_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 {
-    ngx_int_t  rv;
+    ngx_http_kafka_main_conf_t  *omcf = data;
+    ngx_http_kafka_main_conf_t  *main_conf = shm_zone->data;
     
-    if (!(r->method & NGX_HTTP_POST)) {
-        return NGX_HTTP_NOT_ALLOWED;
+    /* counters survive reloads */
+    if (omcf) {
+        main_conf->shpool = omcf->shpool;
+        main_conf->sh = omcf->sh;
+        return NGX_OK;
     }
     
-    rv = ngx_http_read_client_request_body(r, ngx_http_kafka_post_callback_handler);
-    if (rv >= NGX_HTTP_SPECIAL_RESPONSE) {
-        return rv;
+    main_conf->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    
+    if (shm_zone->shm.exists) {
+        main_conf->sh = main_conf->shpool->data;
+        return NGX_OK;
     }
     
-    return NGX_DONE;
+    main_conf->sh = ngx_slab_alloc(main_conf->shpool, sizeof(ngx_http_kafka_stats_sh_t));
+    if (main_conf->sh == NULL) {
+        return NGX_ERROR;
+    }
+    
+    main_conf->shpool->data = main_conf->sh;
+    
+    ngx_queue_init(&main_conf->sh->topics);
+    
+    main_conf->shpool->log_ctx = ngx_slab_alloc(main_conf->shpool,
+                                                sizeof(" in kafka stats zone \"\"")
+                                                + shm_zone->shm.name.len);
+    if (main_conf->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+    
+    ngx_sprintf(main_conf->shpool->log_ctx, " in kafka stats zone \"%V\"%Z",
+                &shm_zone->shm.name);
+    
+    return NGX_OK;
 }
 
-static void ngx_http_kafka_post_callback_handler(ngx_http_request_t *r)
+char *ngx_http_kafka_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
-    static const char rc[] = "ok\n";
+    ngx_http_core_loc_conf_t  *clcf;
     
-    int                          nbufs;
-    u_char                      *msg;
-    size_t                       len;
-    ngx_buf_t                   *buf;
-    ngx_chain_t                  out;
-    ngx_chain_t                 *cl, *in;
-    ngx_http_request_body_t     *body;
-    ngx_http_kafka_main_conf_t  *main_conf = NULL;
-    ngx_http_kafka_loc_conf_t   *local_conf;
-    int                         *is_in_kafka = 1;
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_kafka_status_handler;
+    
+    return NGX_CONF_OK;
+}
+
+static ngx_int_t ngx_http_kafka_status_handler(ngx_http_request_t *r)
+{
+    size_t                        size;
+    ngx_int_t                     rc;
+    ngx_uint_t                    i;
+    ngx_buf_t                    *b;
+    ngx_chain_t                   out;
+    ngx_queue_t                  *q;
+    ngx_atomic_uint_t             queued, queued_bytes;
+    ngx_http_kafka_main_conf_t   *main_conf;
+    ngx_http_kafka_stats_node_t  *node;
+    
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+    
+    rc = ngx_http_discard_request_body(r);
+    if (rc != NGX_OK) {
+        return rc;
+    }
     
     main_conf = ngx_http_get_module_main_conf(r, ngx_http_kafka_module);
-    local_conf = ngx_http_get_module_loc_conf(r, ngx_http_kafka_module);
     
-    if (local_conf->redis_flag) {
-        redisReply *reply;
-        /* 获取redis库的key */
-        reply = redisCommand(main_conf->redis_ctx,"GET foo");
-        size_t redis_result_len = strlen(reply->str);
-        freeReplyObject(reply);
-        
-        if (!redis_result_len) {
-            is_in_kafka = 0;
-        }
-        
+    if (main_conf->sh == NULL) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "kafka_status requires kafka_stats_zone");
+        return NGX_HTTP_NOT_FOUND;
     }
     
-    if (is_in_kafka) {
-        body = r->request_body;
-        if (body == NULL || body->bufs == NULL) {
-            ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
-            return;
-        }
+    r->headers_out.content_type_len = sizeof("text/plain") - 1;
+    ngx_str_set(&r->headers_out.content_type, "text/plain");
+    r->headers_out.content_type_lowcase = NULL;
+    
+    ngx_shmtx_lock(&main_conf->shpool->mutex);
+    
+    size = 0;
+    
+    for (q = ngx_queue_head(&main_conf->sh->topics);
+         q != ngx_queue_sentinel(&main_conf->sh->topics);
+         q = ngx_queue_next(q))
+    {
+        node = ngx_queue_data(q, ngx_http_kafka_stats_node_t, queue);
         
-        len = 0;
-        nbufs = 0;
-        in = body->bufs;
-        for (cl = in; cl != NULL; cl = cl->next) {
-            nbufs++;
-            len += (size_t)(cl->buf->last - cl->buf->pos);
-        }
+        size += sizeof("topic: \n") - 1 + node->len
+                + sizeof(" produced: failed: rejected: \n") - 1 + 3 * NGX_ATOMIC_T_LEN
+                + sizeof(" queued: bytes: \n") - 1 + 2 * NGX_ATOMIC_T_LEN
+                + sizeof(" latency:\n") - 1
+                + NGX_HTTP_KAFKA_LATENCY_BUCKETS * (sizeof(" <=ms:") - 1 + NGX_INT_T_LEN
+                                                    + NGX_ATOMIC_T_LEN);
+    }
+    
+    b = ngx_create_temp_buf(r->pool, size ? size : 1);
+    if (b == NULL) {
+        ngx_shmtx_unlock(&main_conf->shpool->mutex);
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+    
+    for (q = ngx_queue_head(&main_conf->sh->topics);
+         q != ngx_queue_sentinel(&main_conf->sh->topics);
+         q = ngx_queue_next(q))
+    {
+        node = ngx_queue_data(q, ngx_http_kafka_stats_node_t, queue);
         
-        if (nbufs == 0) {
-            goto end;
-        }
+        b->last = ngx_sprintf(b->last, "topic: %*s\n", node->len, node->name);
+        b->last = ngx_sprintf(b->last, " produced: %uA failed: %uA rejected: %uA\n",
+                              node->produced, node->failed, node->rejected);
+        queued = 0;
+        queued_bytes = 0;
         
-        if (nbufs == 1 && ngx_buf_in_memory(in->buf)) {
-            
-            msg = in->buf->pos;
-            
-        } else {
-            
-            if ((msg = ngx_pnalloc(r->pool, len)) == NULL) {
-                ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
-                return;
-            }
-            
-            for (cl = in; cl != NULL; cl = cl->next) {
-                if (ngx_buf_in_memory(cl->buf)) {
-                    msg = ngx_copy(msg, cl->buf->pos, cl->buf->last - cl->buf->pos);
-                } else {
-                    /* TODO: handle buf in file */
-                    ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
-                                  "ngx_http_kafka_handler cannot handler in-file-post-buf");
-                    goto end;
-                }
-            }
-            
-            msg -= len;
-            
+        for (i = 0; i < NGX_MAX_PROCESSES; i++) {
+            queued += node->gauge[i].queued;
+            queued_bytes += node->gauge[i].queued_bytes;
         }
         
+        b->last = ngx_sprintf(b->last, " queued: %uA bytes: %uA\n",
+                              queued, queued_bytes);
+        b->last = ngx_cpymem(b->last, " latency:", sizeof(" latency:") - 1);
         
-        if (local_conf->rkt == NULL) {
-            ngx_str_helper(&local_conf->topic, ngx_str_push);
-            local_conf->rkt = rd_kafka_topic_new(main_conf->rk,
-                                                 (const char *)local_conf->topic.data, local_conf->rktc);
-            ngx_str_helper(&local_conf->topic, ngx_str_pop);
+        for (i = 0; i < NGX_HTTP_KAFKA_LATENCY_BUCKETS - 1; i++) {
+            b->last = ngx_sprintf(b->last, " <=%Mms:%uA",
+                                  ngx_http_kafka_latency_bounds[i], node->latency[i]);
         }
         
-        rd_kafka_produce(local_conf->rkt, RD_KAFKA_PARTITION_UA,
-                         RD_KAFKA_MSG_F_COPY, (void *)msg, len, NULL, 0, r->connection->log);
+        b->last = ngx_sprintf(b->last, " inf:%uA\n", node->latency[i]);
     }
-
     
-end:
+    ngx_shmtx_unlock(&main_conf->shpool->mutex);
     
-    buf = ngx_pcalloc(r->pool, sizeof(ngx_buf_t));
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
     
-    if (buf) {
-        out.buf = buf;
-        out.next = NULL;
-        buf->pos = (u_char *)rc;
-        buf->last = (u_char *)rc + sizeof(rc) - 1;
-        buf->memory = 1;
-        buf->last_buf = 1;
-    }
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
     
-    ngx_str_set(&(r->headers_out.content_type), "text/html");
-    r->headers_out.status = NGX_HTTP_OK;
-    r->headers_out.content_length_n = sizeof(rc) - 1;
-    ngx_http_send_header(r);
-    ngx_http_output_filter(r, &out);
-    ngx_http_finalize_request(r, NGX_OK);
+    rc = ngx_http_send_header(r);
     
-    int kafka_num = rd_kafka_thread_cnt();
-    ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
-                  "kafka threads num is %d\n",kafka_num);
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
     
-    rd_kafka_poll(main_conf->rk, 0);
+    out.buf = b;
+    out.next = NULL;
+    
+    return ngx_http_output_filter(r, &out);
+}
+
+static void ngx_http_kafka_redis_read_handler(ngx_event_t *ev)
+{
+    ngx_connection_t  *c = ev->data;
+    
+    redisAsyncHandleRead(c->data);
+}
+
+static void ngx_http_kafka_redis_write_handler(ngx_event_t *ev)
+{
+    ngx_connection_t  *c = ev->data;
+    
+    redisAsyncHandleWrite(c->data);
+}
+
+static void ngx_http_kafka_redis_add_read(void *privdata)
+{
+    ngx_connection_t  *c = privdata;
+    
+    if (!c->read->active) {
+        ngx_add_event(c->read, NGX_READ_EVENT, NGX_LEVEL_EVENT);
+    }
+}
+
+static void ngx_http_kafka_redis_del_read(void *privdata)
+{
+    ngx_connection_t  *c = privdata;
+    
+    if (c->read->active) {
+        ngx_del_event(c->read, NGX_READ_EVENT, 0);
+    }
+}
+
+static void ngx_http_kafka_redis_add_write(void *privdata)
+{
+    ngx_connection_t  *c = privdata;
+    
+    if (!c->write->active) {
+        ngx_add_event(c->write, NGX_WRITE_EVENT, NGX_LEVEL_EVENT);
+    }
+}
+
+static void ngx_http_kafka_redis_del_write(void *privdata)
+{
+    ngx_connection_t  *c = privdata;
+    
+    if (c->write->active) {
+        ngx_del_event(c->write, NGX_WRITE_EVENT, 0);
+    }
+}
+
+static void ngx_http_kafka_redis_cleanup(void *privdata)
+{
+    ngx_connection_t  *c = privdata;
+    
+    ngx_http_kafka_redis_del_read(c);
+    ngx_http_kafka_redis_del_write(c);
+    
+    /* the socket itself is closed by hiredis */
+    ngx_free_connection(c);
+}
+
+static void ngx_http_kafka_redis_disconnected(const redisAsyncContext *ac, int status)
+{
+    ngx_http_kafka_main_conf_t  *mcf = ac->data;
+    
+    if (status != REDIS_OK) {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                      "redis connection lost: %s", ac->errstr);
+    }
+    
+    if (mcf->redis_actx == ac) {
+        mcf->redis_actx = NULL;
+    }
+}
+
+static void ngx_http_kafka_redis_connected(const redisAsyncContext *ac, int status)
+{
+    if (status != REDIS_OK) {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                      "redis connect failed: %s", ac->errstr);
+        ngx_http_kafka_redis_disconnected(ac, status);
+    }
+}
+
+static redisAsyncContext *ngx_http_kafka_redis_connect(ngx_http_kafka_main_conf_t *mcf,
+                                                       ngx_log_t *log)
+{
+    ngx_connection_t   *c;
+    redisAsyncContext  *ac;
+    
+    ac = redisAsyncConnect((const char *)mcf->redis_addr, mcf->redis_port);
+    if (ac == NULL) {
+        ngx_log_error(NGX_LOG_ERR, log, 0, "can't allocate redis context");
+        return NULL;
+    }
+    
+    if (ac->err) {
+        ngx_log_error(NGX_LOG_ERR, log, 0, "redis connect failed: %s", ac->errstr);
+        redisAsyncFree(ac);
+        return NULL;
+    }
+    
+    c = ngx_get_connection(ac->c.fd, log);
+    if (c == NULL) {
+        redisAsyncFree(ac);
+        return NULL;
+    }
+    
+    c->data = ac;
+    c->log = log;
+    c->read->handler = ngx_http_kafka_redis_read_handler;
+    c->write->handler = ngx_http_kafka_redis_write_handler;
+    c->read->log = log;
+    c->write->log = log;
+    
+    ac->data = mcf;
+    ac->ev.data = c;
+    ac->ev.addRead = ngx_http_kafka_redis_add_read;
+    ac->ev.delRead = ngx_http_kafka_redis_del_read;
+    ac->ev.addWrite = ngx_http_kafka_redis_add_write;
+    ac->ev.delWrite = ngx_http_kafka_redis_del_write;
+    ac->ev.cleanup = ngx_http_kafka_redis_cleanup;
+    
+    redisAsyncSetConnectCallback(ac, ngx_http_kafka_redis_connected);
+    redisAsyncSetDisconnectCallback(ac, ngx_http_kafka_redis_disconnected);
+    
+    mcf->redis_actx = ac;
+    
+    return ac;
+}
+
+static ngx_int_t ngx_http_kafka_handler(ngx_http_request_t *r)
+{
+    ngx_int_t                     rv;
+    ngx_http_kafka_loc_conf_t    *local_conf;
+    ngx_http_kafka_main_conf_t   *main_conf;
+    ngx_http_kafka_stats_node_t  *stats;
+    
+    if (!(r->method & NGX_HTTP_POST)) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+    
+    main_conf = ngx_http_get_module_main_conf(r, ngx_http_kafka_module);
+    local_conf = ngx_http_get_module_loc_conf(r, ngx_http_kafka_module);
+    
+    /* shed load before reading the body when the brokers lag */
+    if (local_conf->queue_high_water
+        && rd_kafka_outq_len(main_conf->rk) >= local_conf->queue_high_water)
+    {
+        stats = ngx_http_kafka_stats_node(r);
+        if (stats) {
+            (void) ngx_atomic_fetch_add(&stats->rejected, 1);
+        }
+        
+        ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                      "kafka queue is over the high-water mark");
+        
+        return local_conf->overload_status;
+    }
+    
+    rv = ngx_http_read_client_request_body(r, ngx_http_kafka_post_callback_handler);
+    if (rv >= NGX_HTTP_SPECIAL_RESPONSE) {
+        return rv;
+    }
+    
+    return NGX_DONE;
+}
+
+static void ngx_http_kafka_post_callback_handler(ngx_http_request_t *r)
+{
+    ngx_http_kafka_loc_conf_t   *local_conf;
+    
+    local_conf = ngx_http_get_module_loc_conf(r, ngx_http_kafka_module);
+    
+    /* the request may now wait for redis or a thread, keep phases out */
+    r->write_event_handler = ngx_http_request_empty_handler;
+    
+    if (local_conf->redis_flag) {
+        /* 异步查询redis, 结果在ngx_http_kafka_redis_done中处理 */
+        if (ngx_http_kafka_redis_check(r) == NGX_OK) {
+            return;
+        }
+        
+        ngx_http_kafka_redis_done(r, NGX_ERROR);
+        return;
+    }
+    
+    ngx_http_kafka_produce_and_respond(r, 1);
+}
+
+static ngx_int_t ngx_http_kafka_redis_check(ngx_http_request_t *r)
+{
+    redisAsyncContext             *ac;
+    ngx_pool_cleanup_t            *cln;
+    ngx_http_kafka_loc_conf_t     *local_conf;
+    ngx_http_kafka_main_conf_t    *main_conf;
+    ngx_http_kafka_redis_check_t  *check;
+    
+    main_conf = ngx_http_get_module_main_conf(r, ngx_http_kafka_module);
+    local_conf = ngx_http_get_module_loc_conf(r, ngx_http_kafka_module);
+    
+    if (main_conf->redis_addr == NULL) {
+        return NGX_ERROR;
+    }
+    
+    /* timed out checks stay pending too, do not pile them up on a slow redis */
+    if (local_conf->redis_max_pending
+        && main_conf->redis_pending >= (ngx_uint_t) local_conf->redis_max_pending)
+    {
+        ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                      "too many pending redis checks");
+        return NGX_ERROR;
+    }
+    
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+    
+    ac = main_conf->redis_actx;
+    if (ac == NULL) {
+        ac = ngx_http_kafka_redis_connect(main_conf, ngx_cycle->log);
+        if (ac == NULL) {
+            return NGX_ERROR;
+        }
+    }
+    
+    check = ngx_alloc(sizeof(ngx_http_kafka_redis_check_t), r->connection->log);
+    if (check == NULL) {
+        return NGX_ERROR;
+    }
+    
+    ngx_memzero(check, sizeof(ngx_http_kafka_redis_check_t));
+    
+    check->request = r;
+    check->cleanup = cln;
+    check->timer.handler = ngx_http_kafka_redis_timeout;
+    check->timer.data = check;
+    check->timer.log = r->connection->log;
+    
+    /* 获取redis库的key */
+    if (redisAsyncCommand(ac, ngx_http_kafka_redis_reply, check, "GET foo")
+        != REDIS_OK)
+    {
+        ngx_free(check);
+        return NGX_ERROR;
+    }
+    
+    main_conf->redis_pending++;
+    
+    cln->handler = ngx_http_kafka_redis_detach;
+    cln->data = check;
+    
+    ngx_add_timer(&check->timer, local_conf->redis_timeout);
+    
+    return NGX_OK;
+}
+
+static void ngx_http_kafka_redis_reply(redisAsyncContext *ac, void *reply, void *privdata)
+{
+    ngx_int_t                      rc;
+    redisReply                    *rr = reply;
+    ngx_http_request_t            *r;
+    ngx_http_kafka_main_conf_t    *mcf = ac->data;
+    ngx_http_kafka_redis_check_t  *check = privdata;
+    
+    mcf->redis_pending--;
+    
+    r = check->request;
+    
+    if (r) {
+        check->cleanup->handler = NULL;
+    }
+    
+    if (check->timer.timer_set) {
+        ngx_del_timer(&check->timer);
+    }
+    
+    ngx_free(check);
+    
+    /*
+     * the request has already gone on after a timeout, or the worker
+     * exits and redisAsyncFree() drops the pending commands
+     */
+    if (r == NULL || ngx_http_kafka_exiting) {
+        return;
+    }
+    
+    if (rr == NULL || rr->type == REDIS_REPLY_ERROR) {
+        rc = NGX_ERROR;
+        
+    } else if (rr->type == REDIS_REPLY_STRING && rr->len) {
+        rc = NGX_OK;
+        
+    } else {
+        rc = NGX_DECLINED;
+    }
+    
+    ngx_http_kafka_redis_done(r, rc);
+}
+
+static void ngx_http_kafka_redis_timeout(ngx_event_t *ev)
+{
+    ngx_http_request_t            *r;
+    ngx_http_kafka_redis_check_t  *check = ev->data;
+    
+    r = check->request;
+    check->request = NULL;
+    check->cleanup->handler = NULL;
+    
+    ngx_log_error(NGX_LOG_WARN, ev->log, 0, "redis check timed out");
+    
+    ngx_http_kafka_redis_done(r, NGX_ERROR);
+}
+
+/* the request is freed while redis still owns the check */
+static void ngx_http_kafka_redis_detach(void *data)
+{
+    ngx_http_kafka_redis_check_t  *check = data;
+    
+    check->request = NULL;
+    
+    if (check->timer.timer_set) {
+        ngx_del_timer(&check->timer);
+    }
+}
+
+static void ngx_http_kafka_redis_done(ngx_http_request_t *r, ngx_int_t rc)
+{
+    ngx_connection_t           *c;
+    ngx_http_kafka_loc_conf_t  *local_conf;
+    
+    c = r->connection;
+    local_conf = ngx_http_get_module_loc_conf(r, ngx_http_kafka_module);
+    
+    switch (rc) {
+        
+        case NGX_OK:
+            ngx_http_kafka_produce_and_respond(r, 1);
+            break;
+        
+        case NGX_DECLINED:
+            ngx_http_kafka_produce_and_respond(r, 0);
+            break;
+        
+        default:
+            if (local_conf->redis_fail == NGX_HTTP_KAFKA_REDIS_FAIL_CLOSED) {
+                ngx_http_finalize_request(r, NGX_HTTP_SERVICE_UNAVAILABLE);
+                break;
+            }
+            
+            ngx_http_kafka_produce_and_respond(r, 1);
+            break;
+    }
+    
+    ngx_http_run_posted_requests(c);
+}
+
+static void ngx_http_kafka_produce_and_respond(ngx_http_request_t *r, ngx_uint_t produce)
+{
+    off_t                       len;
+    ngx_int_t                   rc;
+    ngx_str_t                   value;
+    ngx_chain_t                *cl;
+    ngx_http_kafka_ctx_t       *ctx;
+    ngx_http_request_body_t    *body;
+    ngx_http_kafka_loc_conf_t  *local_conf;
+    
+    if (!produce) {
+        ngx_http_kafka_finalize(r, NULL, NGX_OK);
+        return;
+    }
+    
+    body = r->request_body;
+    if (body == NULL || body->bufs == NULL) {
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return;
+    }
+    
+    len = 0;
+    for (cl = body->bufs; cl != NULL; cl = cl->next) {
+        len += ngx_buf_size(cl->buf);
+    }
+    
+    ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_kafka_ctx_t));
+    if (ctx == NULL) {
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return;
+    }
+    
+    ctx->request = r;
+    ctx->in = body->bufs;
+    ctx->rest = len;
+    ctx->partition = RD_KAFKA_PARTITION_UA;
+    
+    local_conf = ngx_http_get_module_loc_conf(r, ngx_http_kafka_module);
+    
+    /* evaluated once: every message of the body goes to one partition */
+    
+    if (local_conf->key
+        && ngx_http_complex_value(r, local_conf->key, &ctx->key) != NGX_OK)
+    {
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return;
+    }
+    
+    if (local_conf->partition) {
+        if (ngx_http_complex_value(r, local_conf->partition, &value) != NGX_OK) {
+            ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+        
+        if (value.len) {
+            rc = ngx_atoi(value.data, value.len);
+            
+            if (rc == NGX_ERROR || rc > NGX_MAX_INT32_VALUE) {
+                ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                              "invalid kafka partition \"%V\"", &value);
+                ngx_http_finalize_request(r, NGX_HTTP_BAD_REQUEST);
+                return;
+            }
+            
+            ctx->partition = (int32_t) rc;
+        }
+    }
+    
+    ngx_http_set_ctx(r, ctx, ngx_http_kafka_module);
+    
+    if (local_conf->split) {
+        rc = ngx_http_kafka_produce_records(r, ctx);
+        
+    } else {
+        rc = ngx_http_kafka_produce_body(r, ctx);
+    }
+    
+    if (rc == NGX_AGAIN) {
+        /* a temp file chunk is being read by a thread */
+        return;
+    }
+    
+    ngx_http_kafka_finalize(r, ctx, rc);
+}
+
+static ngx_int_t ngx_http_kafka_produce_body(ngx_http_request_t *r, ngx_http_kafka_ctx_t *ctx)
+{
+    size_t                       size, n;
+    ssize_t                      rd;
+    ngx_int_t                    rc;
+    ngx_buf_t                   *b;
+    ngx_http_kafka_loc_conf_t   *local_conf;
+#if (NGX_THREADS)
+    ngx_http_core_loc_conf_t    *clcf;
+#endif
+    
+    local_conf = ngx_http_get_module_loc_conf(r, ngx_http_kafka_module);
+    
+    for ( ;; ) {
+        
+        if (ctx->msg == NULL) {
+            
+            if (ctx->rest == 0) {
+                return NGX_OK;
+            }
+            
+            size = (size_t) ctx->rest;
+            
+            if (local_conf->chunk_size && size > local_conf->chunk_size) {
+                size = local_conf->chunk_size;
+            }
+            
+            while (ctx->in && ngx_buf_size(ctx->in->buf) == 0) {
+                ctx->in = ctx->in->next;
+            }
+            
+            if (ctx->in == NULL) {
+                ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                              "kafka: request body is shorter than expected");
+                return NGX_ERROR;
+            }
+            
+            b = ctx->in->buf;
+            
+            if (ngx_buf_in_memory(b) && (size_t) (b->last - b->pos) >= size) {
+                
+                /* the whole message is in one buffer, produce it in place */
+                
+                rc = ngx_http_kafka_produce(r, ctx, b->pos, size,
+                                            local_conf->zero_copy ? 0 : RD_KAFKA_MSG_F_COPY);
+                if (rc != NGX_OK) {
+                    return rc;
+                }
+                
+                b->pos += size;
+                ctx->rest -= size;
+                continue;
+            }
+            
+            /*
+             * the message has to be joined anyway, so join it into memory
+             * librdkafka can own (F_FREE) or that lives as long as the
+             * held request: either way it is copied only once
+             */
+            
+            if (local_conf->zero_copy) {
+                ctx->msg = ngx_pnalloc(r->pool, size);
+                ctx->flags = 0;
+                
+            } else {
+                ctx->msg = ngx_alloc(size, r->connection->log);
+                ctx->flags = RD_KAFKA_MSG_F_FREE;
+            }
+            
+            if (ctx->msg == NULL) {
+                return NGX_ERROR;
+            }
+            
+            ctx->last = ctx->msg;
+            ctx->size = size;
+        }
+        
+        while (ctx->last < ctx->msg + ctx->size) {
+            
+            if (ctx->in == NULL) {
+                ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                              "kafka: request body is shorter than expected");
+                rc = NGX_ERROR;
+                goto failed;
+            }
+            
+            b = ctx->in->buf;
+            n = ngx_min((size_t) ngx_buf_size(b),
+                        (size_t) (ctx->msg + ctx->size - ctx->last));
+            
+            if (n == 0) {
+                ctx->in = ctx->in->next;
+                continue;
+            }
+            
+            if (ngx_buf_in_memory(b)) {
+                ctx->last = ngx_cpymem(ctx->last, b->pos, n);
+                b->pos += n;
+                continue;
+            }
+
+#if (NGX_THREADS)
+            clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+            
+            if (clcf->aio == NGX_HTTP_AIO_THREADS) {
+                b->file->thread_handler = ngx_http_kafka_thread_handler;
+                b->file->thread_ctx = r;
+                
+                rd = ngx_thread_read(&ctx->thread_task, b->file, ctx->last, n,
+                                     b->file_pos, r->pool);
+                
+                if (rd == NGX_AGAIN) {
+                    return NGX_AGAIN;
+                }
+                
+            } else
+#endif
+            {
+                rd = ngx_read_file(b->file, ctx->last, n, b->file_pos);
+            }
+            
+            if (rd == NGX_ERROR) {
+                rc = NGX_ERROR;
+                goto failed;
+            }
+            
+            if (rd == 0) {
+                ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                              "kafka: unexpected eof in \"%V\"", &b->file->name);
+                rc = NGX_ERROR;
+                goto failed;
+            }
+            
+            ctx->last += rd;
+            b->file_pos += rd;
+        }
+        
+        rc = ngx_http_kafka_produce(r, ctx, ctx->msg, ctx->size, ctx->flags);
+        if (rc != NGX_OK) {
+            goto failed;
+        }
+        
+        ctx->rest -= ctx->size;
+        ctx->msg = NULL;
+    }
+
+failed:
+    
+    if (ctx->flags & RD_KAFKA_MSG_F_FREE) {
+        ngx_free(ctx->msg);
+    }
+    
+    ctx->msg = NULL;
+    
+    return rc;
 }
 
-ngx_int_t ngx_http_kafka_init_worker(ngx_cycle_t *cycle)
+/*
+ * kafka_split: one message per newline delimited record; records are
+ * produced in place from memory buffers, a record split between buffers
+ * and the parts of the body in a temp file are joined into ctx->msg
+ */
+static ngx_int_t ngx_http_kafka_produce_records(ngx_http_request_t *r,
+                                                ngx_http_kafka_ctx_t *ctx)
 {
     size_t                       n;
-    ngx_http_kafka_main_conf_t  *main_conf;
+    ssize_t                      rd;
+    ngx_int_t                    rc;
+    ngx_buf_t                   *b;
+    ngx_http_core_loc_conf_t    *clcf;
+    ngx_http_kafka_loc_conf_t   *local_conf;
+    
+    local_conf = ngx_http_get_module_loc_conf(r, ngx_http_kafka_module);
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+    
+    for ( ;; ) {
+        
+        while (ctx->in && ngx_buf_size(ctx->in->buf) == 0) {
+            ctx->in = ctx->in->next;
+        }
+        
+        if (ctx->in == NULL) {
+            break;
+        }
+        
+        b = ctx->in->buf;
+        
+        if (ngx_buf_in_memory(b)) {
+            rc = ngx_http_kafka_scan_records(r, ctx, b->pos, b->last,
+                                             local_conf->zero_copy ? 0 : RD_KAFKA_MSG_F_COPY);
+            b->pos = b->last;
+            
+            if (rc != NGX_OK) {
+                goto failed;
+            }
+            
+            continue;
+        }
+        
+        /* the file is read in the chunks it was written with */
+        
+        if (ctx->chunk == NULL) {
+            ctx->chunk = ngx_pnalloc(r->pool, clcf->client_body_buffer_size);
+            if (ctx->chunk == NULL) {
+                rc = NGX_ERROR;
+                goto failed;
+            }
+        }
+        
+        n = ngx_min((size_t) ngx_buf_size(b), clcf->client_body_buffer_size);
+        
+#if (NGX_THREADS)
+        if (clcf->aio == NGX_HTTP_AIO_THREADS) {
+            b->file->thread_handler = ngx_http_kafka_thread_handler;
+            b->file->thread_ctx = r;
+            
+            rd = ngx_thread_read(&ctx->thread_task, b->file, ctx->chunk, n,
+                                 b->file_pos, r->pool);
+            
+            if (rd == NGX_AGAIN) {
+                return NGX_AGAIN;
+            }
+        
+        } else
+#endif
+        {
+            rd = ngx_read_file(b->file, ctx->chunk, n, b->file_pos);
+        }
+        
+        if (rd == NGX_ERROR) {
+            rc = NGX_ERROR;
+            goto failed;
+        }
+        
+        if (rd == 0) {
+            ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                          "kafka: unexpected eof in \"%V\"", &b->file->name);
+            rc = NGX_ERROR;
+            goto failed;
+        }
+        
+        b->file_pos += rd;
+        
+        /* the chunk is reused, librdkafka has to copy the records */
+        rc = ngx_http_kafka_scan_records(r, ctx, ctx->chunk, ctx->chunk + rd,
+                                         RD_KAFKA_MSG_F_COPY);
+        if (rc != NGX_OK) {
+            goto failed;
+        }
+    }
+    
+    if (ctx->msg == NULL) {
+        return NGX_OK;
+    }
+    
+    /* the last record may go without a newline */
+    
+    rc = ngx_http_kafka_produce_record(r, ctx, ctx->msg, ctx->last, RD_KAFKA_MSG_F_FREE);
+    if (rc == NGX_OK) {
+        ctx->msg = NULL;
+        return NGX_OK;
+    }
+    
+failed:
+    
+    if (ctx->msg) {
+        ngx_free(ctx->msg);
+        ctx->msg = NULL;
+    }
+    
+    return rc;
+}
+
+static ngx_int_t ngx_http_kafka_scan_records(ngx_http_request_t *r,
+                                             ngx_http_kafka_ctx_t *ctx,
+                                             u_char *p, u_char *end, int flags)
+{
+    size_t     n, size;
+    u_char    *nl, *msg;
+    ngx_int_t  rc;
+    
+    for ( ;; ) {
+        nl = memchr(p, LF, end - p);
+        
+        n = (nl ? nl : end) - p;
+        
+        if (ctx->msg == NULL) {
+            
+            if (nl == NULL) {
+                break;
+            }
+            
+            rc = ngx_http_kafka_produce_record(r, ctx, p, nl, flags);
+            if (rc != NGX_OK) {
+                return rc;
+            }
+            
+            p = nl + 1;
+            continue;
+        }
+        
+        /* the record started in a previous buffer */
+        
+        if ((size_t) (ctx->msg + ctx->size - ctx->last) < n) {
+            size = ngx_max(2 * ctx->size, (size_t) (ctx->last - ctx->msg) + n);
+            
+            msg = ngx_alloc(size, r->connection->log);
+            if (msg == NULL) {
+                return NGX_ERROR;
+            }
+            
+            ctx->last = ngx_cpymem(msg, ctx->msg, ctx->last - ctx->msg);
+            ngx_free(ctx->msg);
+            
+            ctx->msg = msg;
+            ctx->size = size;
+        }
+        
+        ctx->last = ngx_cpymem(ctx->last, p, n);
+        
+        if (nl == NULL) {
+            return NGX_OK;
+        }
+        
+        msg = ctx->msg;
+        ctx->msg = NULL;
+        
+        rc = ngx_http_kafka_produce_record(r, ctx, msg, ctx->last, RD_KAFKA_MSG_F_FREE);
+        if (rc != NGX_OK) {
+            ngx_free(msg);
+            return rc;
+        }
+        
+        p = nl + 1;
+    }
+    
+    if (p == end) {
+        return NGX_OK;
+    }
+    
+    /* keep the incomplete record until its end comes */
+    
+    size = ngx_max((size_t) (end - p), 512);
+    
+    ctx->msg = ngx_alloc(size, r->connection->log);
+    if (ctx->msg == NULL) {
+        return NGX_ERROR;
+    }
+    
+    ctx->last = ngx_cpymem(ctx->msg, p, end - p);
+    ctx->size = size;
+    
+    return NGX_OK;
+}
+
+static ngx_int_t ngx_http_kafka_produce_record(ngx_http_request_t *r, ngx_http_kafka_ctx_t *ctx,
+                                               u_char *start, u_char *end, int flags)
+{
+    ngx_int_t  rc;
+    
+    if (end > start && *(end - 1) == CR) {
+        end--;
+    }
+    
+    if (end == start) {
+        /* blank lines separate nothing */
+        if (flags & RD_KAFKA_MSG_F_FREE) {
+            ngx_free(start);
+        }
+        ctx->lines++;
+        return NGX_OK;
+    }
+    
+    rc = ngx_http_kafka_produce(r, ctx, start, end - start, flags);
+    
+    if (rc == NGX_OK) {
+        ctx->lines++;
+    }
+    
+    return rc;
+}
+
+static ngx_int_t ngx_http_kafka_produce(ngx_http_request_t *r, ngx_http_kafka_ctx_t *ctx,
+                                        u_char *msg, size_t len, int flags)
+{
+    int32_t                       partition;
+    ngx_str_t                     key;
+    rd_kafka_resp_err_t           err;
+    ngx_http_kafka_msg_t         *m;
+    ngx_http_kafka_main_conf_t   *main_conf;
+    ngx_http_kafka_loc_conf_t    *local_conf;
+    ngx_http_kafka_stats_node_t  *stats;
+    
+    main_conf = ngx_http_get_module_main_conf(r, ngx_http_kafka_module);
+    local_conf = ngx_http_get_module_loc_conf(r, ngx_http_kafka_module);
+    
+    stats = ngx_http_kafka_stats_node(r);
+    
+    /* librdkafka copies the key */
+    key = ctx->key;
+    partition = ctx->partition;
+    
+    if (flags & (RD_KAFKA_MSG_F_COPY|RD_KAFKA_MSG_F_FREE)) {
+        /* only messages pointing into request memory hold the request */
+        ctx = NULL;
+    }
+    
+    m = NULL;
+    
+    if (ctx || stats) {
+        m = ngx_alloc(sizeof(ngx_http_kafka_msg_t), r->connection->log);
+        if (m == NULL) {
+            return NGX_ERROR;
+        }
+        
+        m->ctx = ctx;
+        m->stats = stats;
+        m->start = ngx_current_msec;
+        m->len = len;
+    }
+    
+    if (local_conf->rkt == NULL) {
+        ngx_str_helper(&local_conf->topic, ngx_str_push);
+        local_conf->rkt = rd_kafka_topic_new(main_conf->rk,
+                                             (const char *)local_conf->topic.data, local_conf->rktc);
+        ngx_str_helper(&local_conf->topic, ngx_str_pop);
+    }
+    
+    if (rd_kafka_produce(local_conf->rkt, partition, flags, (void *)msg, len,
+                         key.len ? key.data : NULL, key.len, m) == -1)
+    {
+        err = rd_kafka_last_error();
+        
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "rd_kafka_produce() failed: %s", rd_kafka_err2str(err));
+        
+        if (m) {
+            ngx_free(m);
+        }
+        
+        /* counted as rejected by ngx_http_kafka_finalize() */
+        if (stats && err != RD_KAFKA_RESP_ERR__QUEUE_FULL) {
+            (void) ngx_atomic_fetch_add(&stats->failed, 1);
+        }
+        
+        /* the local queue is full: report overload rather than an error */
+        return (err == RD_KAFKA_RESP_ERR__QUEUE_FULL) ? NGX_DECLINED : NGX_ERROR;
+    }
+    
+    if (stats) {
+        (void) ngx_atomic_fetch_add(&stats->gauge[ngx_process_slot].queued, 1);
+        (void) ngx_atomic_fetch_add(&stats->gauge[ngx_process_slot].queued_bytes, len);
+    }
+    
+    if (ctx) {
+        ctx->pending++;
+    }
+    
+    return NGX_OK;
+}
+
+#if (NGX_THREADS)
+
+static ngx_int_t ngx_http_kafka_thread_handler(ngx_thread_task_t *task, ngx_file_t *file)
+{
+    ngx_str_t                  name;
+    ngx_thread_pool_t         *tp;
+    ngx_http_request_t        *r;
+    ngx_http_core_loc_conf_t  *clcf;
+    
+    r = file->thread_ctx;
+    
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+    tp = clcf->thread_pool;
+    
+    if (tp == NULL) {
+        if (ngx_http_complex_value(r, clcf->thread_pool_value, &name)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+        
+        tp = ngx_thread_pool_get((ngx_cycle_t *) ngx_cycle, &name);
+        
+        if (tp == NULL) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "thread pool \"%V\" not found", &name);
+            return NGX_ERROR;
+        }
+    }
+    
+    task->event.data = r;
+    task->event.handler = ngx_http_kafka_thread_event_handler;
+    
+    if (ngx_thread_task_post(tp, task) != NGX_OK) {
+        return NGX_ERROR;
+    }
+    
+    r->main->blocked++;
+    r->aio = 1;
+    
+    return NGX_OK;
+}
+
+static void ngx_http_kafka_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_int_t                   rc;
+    ngx_connection_t           *c;
+    ngx_http_request_t         *r;
+    ngx_http_kafka_ctx_t       *ctx;
+    ngx_http_kafka_loc_conf_t  *local_conf;
+    
+    r = ev->data;
+    c = r->connection;
+    
+    r->main->blocked--;
+    r->aio = 0;
+    
+    ctx = ngx_http_get_module_ctx(r, ngx_http_kafka_module);
+    local_conf = ngx_http_get_module_loc_conf(r, ngx_http_kafka_module);
+    
+    if (local_conf->split) {
+        rc = ngx_http_kafka_produce_records(r, ctx);
+        
+    } else {
+        rc = ngx_http_kafka_produce_body(r, ctx);
+    }
+    
+    if (rc != NGX_AGAIN) {
+        ngx_http_kafka_finalize(r, ctx, rc);
+    }
+    
+    ngx_http_run_posted_requests(c);
+}
+
+#endif
+
+/*
+ * kafka_split produces the records in order and stops at the first one
+ * that fails: the lines before it are already queued and cannot be taken
+ * back, so the error response tells the client how many were accepted
+ * and a retry can resume after them instead of duplicating them.
+ */
+static void ngx_http_kafka_finalize(ngx_http_request_t *r, ngx_http_kafka_ctx_t *ctx, ngx_int_t rc)
+{
+    static const char ok[] = "ok\n";
+    
+    ngx_uint_t                    status;
+    ngx_buf_t                    *buf;
+    ngx_chain_t                   out;
+    ngx_http_kafka_loc_conf_t    *local_conf;
+    ngx_http_kafka_stats_node_t  *stats;
+    
+    if (ctx && ctx->pending) {
+        /* dropped by the delivery report, see kafka_callback_handler() */
+        r->main->count++;
+    }
+    
+    if (rc == NGX_DECLINED) {
+        /* the producer queue is full */
+        local_conf = ngx_http_get_module_loc_conf(r, ngx_http_kafka_module);
+        
+        stats = ngx_http_kafka_stats_node(r);
+        if (stats) {
+            (void) ngx_atomic_fetch_add(&stats->rejected, 1);
+        }
+        
+        status = local_conf->overload_status;
+        
+    } else if (rc >= NGX_HTTP_SPECIAL_RESPONSE) {
+        status = rc;
+        
+    } else if (rc != NGX_OK) {
+        status = NGX_HTTP_INTERNAL_SERVER_ERROR;
+        
+    } else {
+        status = NGX_HTTP_OK;
+    }
+    
+    if (status != NGX_HTTP_OK && (ctx == NULL || ctx->lines == 0)) {
+        ngx_http_finalize_request(r, status);
+        return;
+    }
+    
+    buf = ngx_calloc_buf(r->pool);
+    if (buf == NULL) {
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return;
+    }
+    
+    if (status == NGX_HTTP_OK) {
+        buf->pos = (u_char *)ok;
+        buf->last = (u_char *)ok + sizeof(ok) - 1;
+        buf->memory = 1;
+        
+    } else {
+        ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                      "kafka accepted only the first %ui lines", ctx->lines);
+        
+        buf->pos = ngx_pnalloc(r->pool, sizeof("accepted: \n") - 1 + NGX_INT_T_LEN);
+        if (buf->pos == NULL) {
+            ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+        
+        buf->last = ngx_sprintf(buf->pos, "accepted: %ui\n", ctx->lines);
+        buf->temporary = 1;
+    }
+    
+    out.buf = buf;
+    out.next = NULL;
+    buf->last_buf = 1;
+    
+    ngx_str_set(&(r->headers_out.content_type), "text/html");
+    r->headers_out.status = status;
+    r->headers_out.content_length_n = buf->last - buf->pos;
+    
+    ngx_http_send_header(r);
+    ngx_http_finalize_request(r, ngx_http_output_filter(r, &out));
+}
+
+static ngx_http_kafka_stats_node_t *ngx_http_kafka_stats_node(ngx_http_request_t *r)
+{
+    size_t                        n;
+    ngx_queue_t                  *q;
+    ngx_http_kafka_loc_conf_t    *local_conf;
+    ngx_http_kafka_main_conf_t   *main_conf;
+    ngx_http_kafka_stats_node_t  *node;
+    
+    local_conf = ngx_http_get_module_loc_conf(r, ngx_http_kafka_module);
+    
+    if (local_conf->stats) {
+        return local_conf->stats;
+    }
+    
+    main_conf = ngx_http_get_module_main_conf(r, ngx_http_kafka_module);
+    
+    if (main_conf->sh == NULL) {
+        return NULL;
+    }
+    
+    ngx_shmtx_lock(&main_conf->shpool->mutex);
+    
+    for (q = ngx_queue_head(&main_conf->sh->topics);
+         q != ngx_queue_sentinel(&main_conf->sh->topics);
+         q = ngx_queue_next(q))
+    {
+        node = ngx_queue_data(q, ngx_http_kafka_stats_node_t, queue);
+        
+        if (node->len == local_conf->topic.len
+            && ngx_strncmp(node->name, local_conf->topic.data, node->len) == 0)
+        {
+            goto found;
+        }
+    }
+    
+    n = offsetof(ngx_http_kafka_stats_node_t, name) + local_conf->topic.len;
+    
+    node = ngx_slab_calloc_locked(main_conf->shpool, n);
+    if (node == NULL) {
+        ngx_shmtx_unlock(&main_conf->shpool->mutex);
+        
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "could not allocate kafka stats node in \"%V\" zone",
+                      &main_conf->stats_zone->shm.name);
+        return NULL;
+    }
+    
+    node->len = local_conf->topic.len;
+    ngx_memcpy(node->name, local_conf->topic.data, node->len);
+    
+    ngx_queue_insert_tail(&main_conf->sh->topics, &node->queue);
+
+found:
+    
+    ngx_shmtx_unlock(&main_conf->shpool->mutex);
+    
+    local_conf->stats = node;
+    
+    return node;
+}
+
+static void ngx_http_kafka_poll_handler(ngx_event_t *ev)
+{
+    ngx_http_kafka_main_conf_t  *main_conf = ev->data;
+    
+    /* serves delivery reports even when no requests come in */
+    rd_kafka_poll(main_conf->rk, 0);
+    
+    ngx_add_timer(ev, main_conf->poll_interval);
+}
+
+ngx_int_t ngx_http_kafka_init_worker(ngx_cycle_t *cycle)
+{
+    size_t                        n;
+    char                          errstr[512];
+    u_char                        value[NGX_INT_T_LEN + 1];
+    ngx_queue_t                  *q;
+    ngx_http_kafka_main_conf_t   *main_conf;
+    ngx_http_kafka_stats_node_t  *node;
     
     main_conf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_kafka_module);
     
+    if (main_conf->sh) {
+        /* drop what a previous worker in this slot left queued */
+        ngx_shmtx_lock(&main_conf->shpool->mutex);
+        
+        for (q = ngx_queue_head(&main_conf->sh->topics);
+             q != ngx_queue_sentinel(&main_conf->sh->topics);
+             q = ngx_queue_next(q))
+        {
+            node = ngx_queue_data(q, ngx_http_kafka_stats_node_t, queue);
+            
+            node->gauge[ngx_process_slot].queued = 0;
+            node->gauge[ngx_process_slot].queued_bytes = 0;
+        }
+        
+        ngx_shmtx_unlock(&main_conf->shpool->mutex);
+    }
+    
     main_conf->rkc = rd_kafka_conf_new();
     rd_kafka_conf_set_dr_cb(main_conf->rkc, kafka_callback_handler);
     
+    if (main_conf->batch_size != NGX_CONF_UNSET) {
+        ngx_sprintf(value, "%i%Z", main_conf->batch_size);
+        
+        if (rd_kafka_conf_set(main_conf->rkc, "batch.num.messages",
+                              (const char *) value, errstr, sizeof(errstr))
+            != RD_KAFKA_CONF_OK)
+        {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                          "kafka_batch_size: %s", errstr);
+            return NGX_ERROR;
+        }
+    }
+    
+    if (main_conf->linger != NGX_CONF_UNSET_MSEC) {
+        ngx_sprintf(value, "%M%Z", main_conf->linger);
+        
+        if (rd_kafka_conf_set(main_conf->rkc, "queue.buffering.max.ms",
+                              (const char *) value, errstr, sizeof(errstr))
+            != RD_KAFKA_CONF_OK)
+        {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                          "kafka_linger_ms: %s", errstr);
+            return NGX_ERROR;
+        }
+    }
+    
     main_conf->rk = rd_kafka_new(RD_KAFKA_PRODUCER, main_conf->rkc, NULL, 0);
     
     for (n = 0; n != main_conf->nbrokers; ++n) {
@@ -445,6 +2103,22 @@ ngx_int_t ngx_http_kafka_init_worker(ngx_cycle_t *cycle)
         ngx_str_helper(&main_conf->brokers[n], ngx_str_pop);
     }
     
+    if (main_conf->poll_interval == NGX_CONF_UNSET_MSEC) {
+        main_conf->poll_interval = 100;
+    }
+    
+    ngx_http_kafka_poll_event.handler = ngx_http_kafka_poll_handler;
+    ngx_http_kafka_poll_event.data = main_conf;
+    ngx_http_kafka_poll_event.log = cycle->log;
+    ngx_http_kafka_poll_event.cancelable = 1;
+    
+    ngx_add_timer(&ngx_http_kafka_poll_event, main_conf->poll_interval);
+    
+    if (main_conf->redis_addr) {
+        /* a failure here is retried on the first request */
+        (void) ngx_http_kafka_redis_connect(main_conf, cycle->log);
+    }
+    
     return 0;
 }
 
@@ -455,6 +2129,8 @@ void ngx_http_kafka_exit_worker(ngx_cycle_t *cycle)
     
     main_conf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_kafka_module);
     
+    ngx_http_kafka_exiting = 1;
+    
     if (main_conf->rk) {
         while (rd_kafka_outq_len(main_conf->rk) > 0)   //https://github.com/edenhill/librdkafka/wiki/Proper-termination-sequence
             rd_kafka_poll(main_conf->rk, 50);
@@ -462,9 +2138,11 @@ void ngx_http_kafka_exit_worker(ngx_cycle_t *cycle)
         rd_kafka_destroy(main_conf->rk);
         rd_kafka_wait_destroyed(50);
     }
-
-    if (main_conf->redis_ctx) {
-        redisFree(main_conf->redis_ctx);
+    
+    if (main_conf->redis_actx) {
+        /* the reply callbacks only free the checks once exiting is set */
+        redisAsyncFree(main_conf->redis_actx);
+        main_conf->redis_actx = NULL;
     }
 }
 
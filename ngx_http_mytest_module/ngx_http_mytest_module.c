@@ -3,21 +3,61 @@
 #include <ngx_http.h>
 
 
+//ֶΪ,ǰ,ǵ,ǵ,ɽ,ɽ
+#define NGX_HTTP_MYTEST_FIELDS       6
+#define NGX_HTTP_MYTEST_MAX_STOCKS   32
+//ȴйƱʱ䣬ʱĹƱٵȴ
+#define NGX_HTTP_MYTEST_DEADLINE     3000
+
+
+/*
+ * one per symbol, set as the context of its subrequest: the body filter
+ * parses the quote line incrementally as buffers arrive
+ */
+typedef struct
+{
+    ngx_str_t       symbol;
+    ngx_uint_t      status;
+
+    ngx_uint_t      state;
+    ngx_uint_t      nfields;
+    size_t          start[NGX_HTTP_MYTEST_FIELDS + 1];
+
+    u_char         *data;
+    size_t          len;
+    size_t          size;
+} ngx_http_mytest_stock_t;
+
+
 typedef struct
 {
-    ngx_str_t		stock[6];
+    ngx_array_t         stocks;
+    ngx_http_fanout_t  *fanout;
 } ngx_http_mytest_ctx_t;
 
 
+enum
+{
+    mytest_stock_wait_quote = 0,
+    mytest_stock_fields,
+    mytest_stock_done
+};
+
+
 static char *
 ngx_http_mytest(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
 static ngx_int_t ngx_http_mytest_handler(ngx_http_request_t *r);
-static ngx_int_t mytest_subrequest_post_handler(ngx_http_request_t *r, void *data, ngx_int_t rc);
 static void
 mytest_post_handler(ngx_http_request_t * r);
 
+static ngx_int_t ngx_http_mytest_init(ngx_conf_t *cf);
+static ngx_int_t ngx_http_mytest_body_filter(ngx_http_request_t *r, ngx_chain_t *in);
+static ngx_int_t mytest_stock_parse(ngx_http_request_t *r, ngx_http_mytest_stock_t *stock,
+                                    u_char *p, u_char *last);
+
 
+static ngx_http_output_body_filter_pt    ngx_http_next_body_filter;
 
 
 static ngx_command_t  ngx_http_mytest_commands[] =
@@ -38,7 +78,7 @@ static ngx_command_t  ngx_http_mytest_commands[] =
 static ngx_http_module_t  ngx_http_mytest_module_ctx =
 {
     NULL,                              /* preconfiguration */
-    NULL,                  		/* postconfiguration */
+    ngx_http_mytest_init,      		/* postconfiguration */
 
     NULL,                              /* create main configuration */
     NULL,                              /* init main configuration */
@@ -66,83 +106,97 @@ ngx_module_t  ngx_http_mytest_module =
     NGX_MODULE_V1_PADDING
 };
 
-static ngx_int_t mytest_subrequest_post_handler(ngx_http_request_t *r,
-                                                void *data, ngx_int_t rc)
+static void
+mytest_post_handler(ngx_http_request_t * r)
 {
-    //ǰrparentԱָ
-    ngx_http_request_t          *pr = r->parent;
-    //ע⣬Ǳڸеģμ5.6.5ڣҪprȡġ
-//ʵи򵥵ķdataģʼsubrequestʱ
-//ǾͶ˵ģΪ˵λȡ
-    ngx_http_mytest_ctx_t* myctx = ngx_http_get_module_ctx(pr, ngx_http_mytest_module);
-
-    pr->headers_out.status = r->headers_out.status;
-    //NGX_HTTP_OKҲ200ζŷ˷ɹŽ
-//ʼhttp
-    if (r->headers_out.status == NGX_HTTP_OK)
-    {
-        int flag = 0;
-
-        //ڲתӦʱbufferлᱣηӦرʹ
-//ģηʱʹupstreamʱûض
-//input_filterupstreamĬϵinput_filterͼ
-//еӦȫ浽buffer
-        ngx_buf_t* pRecvBuf = &r->upstream->buffer;
-
-        //¿ʼηӦֵĽṹ
-//myctx->stock
-        for (; pRecvBuf->pos != pRecvBuf->last; pRecvBuf->pos++)
-        {
-            if (*pRecvBuf->pos == ',' || *pRecvBuf->pos == '\"')
+    size_t                     bodylen;
+    ngx_buf_t                 *b;
+    ngx_uint_t                 i, n, status;
+    ngx_str_t                  f[NGX_HTTP_MYTEST_FIELDS];
+    ngx_http_mytest_stock_t   *stock;
+    ngx_http_fanout_branch_t  *br;
+
+    //ǰǸֱȡġѽʱ
+//ngx_http_fanoutŻ
+    ngx_http_mytest_ctx_t* myctx = ngx_http_get_module_ctx(r, ngx_http_mytest_module);
+
+    //巢ûhttpݣÿ֧ƱһУе˳
+//stock[],Today current price: , volumn: 
+    static ngx_str_t output_format = ngx_string("stock[%V],Today current price: %V, volumn: %V" CRLF);
+    static ngx_str_t unavailable_format = ngx_string("stock[%V],unavailable" CRLF);
+
+    stock = myctx->stocks.elts;
+    br = myctx->fanout->branches.elts;
+
+    //ͰĳȣûõĹƱֻһʾ
+    bodylen = 0;
+    n = 0;
+    status = NGX_HTTP_OK;
+
+    for (i = 0; i < myctx->stocks.nelts; i++)
+    {
+        stock[i].status = br[i].status;
+
+        if (stock[i].status == NGX_HTTP_OK && stock[i].nfields < 5)
+        {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "incomplete quote for stock \"%V\"", &stock[i].symbol);
+            stock[i].status = NGX_HTTP_BAD_GATEWAY;
+        }
+
+        if (stock[i].status != NGX_HTTP_OK)
+        {
+            if (status == NGX_HTTP_OK)
             {
-                if (flag > 0)
-                {
-                    myctx->stock[flag - 1].len = pRecvBuf->pos - myctx->stock[flag - 1].data;
-                }
-                flag++;
-                myctx->stock[flag - 1].data = pRecvBuf->pos + 1;
+                status = stock[i].status ? stock[i].status : NGX_HTTP_BAD_GATEWAY;
             }
 
-            if (flag > 6)
-                break;
+            bodylen += unavailable_format.len - 2 + stock[i].symbol.len;
+            continue;
         }
-    }
-
 
-    //һҪýĻص
-    pr->write_event_handler = mytest_post_handler;
+        n++;
+        bodylen += output_format.len - 6
+                   + stock[i].start[1] - stock[i].start[0] - 1
+                   + stock[i].start[2] - stock[i].start[1] - 1
+                   + stock[i].start[5] - stock[i].start[4] - 1;
+    }
 
-    return NGX_OK;
-}
+    //һ֧ƱҲûõʱֱӰѴ뷢û
+    if (n == 0)
+    {
+        ngx_http_finalize_request(r, status);
+        return;
+    }
 
+    r->headers_out.content_length_n = bodylen;
 
-static void
-mytest_post_handler(ngx_http_request_t * r)
-{
-    //ûз200ֱӰѴ뷢û
-    if (r->headers_out.status != NGX_HTTP_OK)
+    //ڴϷڴ汣潫Ҫ͵İ
+    b = ngx_create_temp_buf(r->pool, bodylen);
+    if (b == NULL)
     {
-        ngx_http_finalize_request(r, r->headers_out.status);
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
         return;
     }
 
-    //ǰǸֱȡ
-    ngx_http_mytest_ctx_t* myctx = ngx_http_get_module_ctx(r, ngx_http_mytest_module);
+    for (i = 0; i < myctx->stocks.nelts; i++)
+    {
+        if (stock[i].status != NGX_HTTP_OK)
+        {
+            b->last = ngx_sprintf(b->last, (char*)unavailable_format.data, &stock[i].symbol);
+            continue;
+        }
 
-    //巢ûhttpݣʽΪ
-//stock[],Today current price: , volumn: 
-    ngx_str_t output_format = ngx_string("stock[%V],Today current price: %V, volumn: %V");
+        f[0].data = stock[i].data + stock[i].start[0];
+        f[0].len = stock[i].start[1] - stock[i].start[0] - 1;
+        f[1].data = stock[i].data + stock[i].start[1];
+        f[1].len = stock[i].start[2] - stock[i].start[1] - 1;
+        f[4].data = stock[i].data + stock[i].start[4];
+        f[4].len = stock[i].start[5] - stock[i].start[4] - 1;
 
-    //Ͱĳ
-    int bodylen = output_format.len + myctx->stock[0].len
-                  + myctx->stock[1].len + myctx->stock[4].len - 6;
-    r->headers_out.content_length_n = bodylen;
+        b->last = ngx_sprintf(b->last, (char*)output_format.data, &f[0], &f[1], &f[4]);
+    }
 
-    //ڴϷڴ汣潫Ҫ͵İ
-    ngx_buf_t* b = ngx_create_temp_buf(r->pool, bodylen);
-    ngx_snprintf(b->pos, bodylen, (char*)output_format.data,
-                 &myctx->stock[0], &myctx->stock[1], &myctx->stock[4]);
-    b->last = b->pos + bodylen;
     b->last_buf = 1;
 
     ngx_chain_t out;
@@ -163,6 +217,127 @@ mytest_post_handler(ngx_http_request_t * r)
 }
 
 
+/*
+ * the quote looks like: var hq_str_s_sh000001="name,price,...,amount";
+ * fields are copied as they arrive, a field may span buffers
+ */
+static ngx_int_t
+mytest_stock_parse(ngx_http_request_t *r, ngx_http_mytest_stock_t *stock,
+                   u_char *p, u_char *last)
+{
+    u_char  *start, *data;
+    size_t   n;
+
+    while (p < last && stock->state != mytest_stock_done)
+    {
+        if (stock->state == mytest_stock_wait_quote)
+        {
+            p = ngx_strlchr(p, last, '"');
+            if (p == NULL)
+            {
+                return NGX_OK;
+            }
+
+            p++;
+            stock->state = mytest_stock_fields;
+            stock->start[0] = stock->len;
+            continue;
+        }
+
+        start = p;
+
+        while (p < last && *p != ',' && *p != '"')
+        {
+            p++;
+        }
+
+        //ÿֶκ涼1ָstart[i + 1] - 1ֶiĽβ
+        n = p - start + (p < last ? 1 : 0);
+
+        if (stock->len + n > stock->size)
+        {
+            stock->size = ngx_max(2 * stock->size, stock->len + n + 64);
+
+            data = ngx_pnalloc(r->pool, stock->size);
+            if (data == NULL)
+            {
+                return NGX_ERROR;
+            }
+
+            ngx_memcpy(data, stock->data, stock->len);
+            stock->data = data;
+        }
+
+        ngx_memcpy(stock->data + stock->len, start, p - start);
+        stock->len += p - start;
+
+        if (p == last)
+        {
+            return NGX_OK;
+        }
+
+        stock->data[stock->len++] = *p;
+
+        if (stock->nfields < NGX_HTTP_MYTEST_FIELDS)
+        {
+            stock->start[++stock->nfields] = stock->len;
+        }
+
+        if (*p++ == '"')
+        {
+            stock->state = mytest_stock_done;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_mytest_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
+{
+    ngx_chain_t              *cl;
+    ngx_http_mytest_stock_t  *stock;
+
+    //ֻmytestǵӦͻ
+    if (r == r->main
+        || ngx_http_get_module_ctx(r->parent, ngx_http_mytest_module) == NULL)
+    {
+        return ngx_http_next_body_filter(r, in);
+    }
+
+    stock = ngx_http_get_module_ctx(r, ngx_http_mytest_module);
+    if (stock == NULL)
+    {
+        return ngx_http_next_body_filter(r, in);
+    }
+
+    for (cl = in; cl; cl = cl->next)
+    {
+        if (r->headers_out.status == NGX_HTTP_OK
+            && mytest_stock_parse(r, stock, cl->buf->pos, cl->buf->last) != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        //ΪѣupstreamЩ
+        cl->buf->pos = cl->buf->last;
+        cl->buf->file_pos = cl->buf->file_last;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_mytest_init(ngx_conf_t *cf)
+{
+    ngx_http_next_body_filter = ngx_http_top_body_filter;
+    ngx_http_top_body_filter = ngx_http_mytest_body_filter;
+
+    return NGX_OK;
+}
+
 
 static char *
 ngx_http_mytest(ngx_conf_t * cf, ngx_command_t * cmd, void * conf)
@@ -185,58 +360,128 @@ ngx_http_mytest(ngx_conf_t * cf, ngx_command_t * cmd, void * conf)
 static ngx_int_t
 ngx_http_mytest_handler(ngx_http_request_t * r)
 {
+    u_char                    *p, *last, *sym;
+    ngx_int_t                  rc;
+    ngx_uint_t                 i;
+    ngx_str_t                  sub_location;
+    ngx_http_mytest_stock_t   *stock;
+    ngx_http_fanout_branch_t  *br;
+
     //http
     ngx_http_mytest_ctx_t* myctx = ngx_http_get_module_ctx(r, ngx_http_mytest_module);
     if (myctx == NULL)
     {
-        myctx = ngx_palloc(r->pool, sizeof(ngx_http_mytest_ctx_t));
+        myctx = ngx_pcalloc(r->pool, sizeof(ngx_http_mytest_ctx_t));
         if (myctx == NULL)
         {
             return NGX_ERROR;
         }
 
+        if (ngx_array_init(&myctx->stocks, r->pool, 4, sizeof(ngx_http_mytest_stock_t))
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
         //õԭʼr
         ngx_http_set_ctx(r, myctx, ngx_http_mytest_module);
     }
 
-    // ngx_http_post_subrequest_tṹĻصμ5.4.1
-    ngx_http_post_subrequest_t *psr = ngx_palloc(r->pool, sizeof(ngx_http_post_subrequest_t));
-    if (psr == NULL)
+    //пж֧Ʊöŷָ?s_sh000001,s_sz399001
+    p = r->args.data;
+    last = p + r->args.len;
+
+    while (p < last)
+    {
+        sym = p;
+        p = ngx_strlchr(p, last, ',');
+        if (p == NULL)
+        {
+            p = last;
+        }
+
+        if (p > sym)
+        {
+            if (myctx->stocks.nelts == NGX_HTTP_MYTEST_MAX_STOCKS)
+            {
+                return NGX_HTTP_BAD_REQUEST;
+            }
+
+            stock = ngx_array_push(&myctx->stocks);
+            if (stock == NULL)
+            {
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
+            }
+
+            ngx_memzero(stock, sizeof(ngx_http_mytest_stock_t));
+            stock->symbol.data = sym;
+            stock->symbol.len = p - sym;
+        }
+
+        p++;
+    }
+
+    if (myctx->stocks.nelts == 0)
+    {
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    //ngx_http_fanoutеط󣬲ȫʱ
+//mytest_post_handlerʹNGX_HTTP_SUBREQUEST_IN_MEMORY
+//Ӧngx_http_mytest_body_filter߽ձ߽
+    myctx->fanout = ngx_http_fanout_create(r, myctx->stocks.nelts);
+    if (myctx->fanout == NULL)
     {
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    //صΪmytest_subrequest_post_handler
-    psr->handler = mytest_subrequest_post_handler;
+    myctx->fanout->flags = 0;
+    myctx->fanout->deadline = NGX_HTTP_MYTEST_DEADLINE;
+    myctx->fanout->handler = mytest_post_handler;
 
-    //dataΪmyctxģصmytest_subrequest_post_handler
-//ʱdatamyctx
-    psr->data = myctx;
+    stock = myctx->stocks.elts;
 
-    //URIǰ׺/listΪ˷
+    for (i = 0; i < myctx->stocks.nelts; i++)
+    {
+        //URIǰ׺/listΪ˷
 ///list=s_sh000001URI5.6.1nginx.conf
 //õlocationеURIһµ
-    ngx_str_t sub_prefix = ngx_string("/list=");
-    ngx_str_t sub_location;
-    sub_location.len = sub_prefix.len + r->args.len;
-    sub_location.data = ngx_palloc(r->pool, sub_location.len);
-    //urlĲĲ
-    ngx_snprintf(sub_location.data, sub_location.len,
-                 "%V%V", &sub_prefix, &r->args);
-
-    //sr
-    ngx_http_request_t *sr;
-    //ngx_http_subrequestֻ᷵NGX_OK
-//NGX_ERRORNGX_OKʱsrѾǺϷע⣬
-//NGX_HTTP_SUBREQUEST_IN_MEMORYupstreamģ
-//ηӦȫsr->upstream->bufferڴ滺
-    ngx_int_t rc = ngx_http_subrequest(r, &sub_location, NULL, &sr, psr, NGX_HTTP_SUBREQUEST_IN_MEMORY);
-    if (rc != NGX_OK)
+        ngx_str_t sub_prefix = ngx_string("/list=");
+        sub_location.len = sub_prefix.len + stock[i].symbol.len;
+        sub_location.data = ngx_pnalloc(r->pool, sub_location.len);
+        if (sub_location.data == NULL)
+        {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        ngx_memcpy(ngx_cpymem(sub_location.data, sub_prefix.data, sub_prefix.len),
+                   stock[i].symbol.data, stock[i].symbol.len);
+
+        br = ngx_http_fanout_add(myctx->fanout, &sub_location, NULL, 0);
+        if (br == NULL)
+        {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        br->data = &stock[i];
+    }
+
+    rc = ngx_http_fanout_start(myctx->fanout);
+    if (rc == NGX_ERROR)
     {
         return NGX_ERROR;
     }
 
-    //뷵NGX_DONEͬupstream
-    return NGX_DONE;
-}
+    br = myctx->fanout->branches.elts;
 
+    for (i = 0; i < myctx->stocks.nelts; i++)
+    {
+        //ʱļеӦҲҪڴٽģ
+        br[i].request->filter_need_in_memory = 1;
+
+        ngx_http_set_ctx(br[i].request, &stock[i], ngx_http_mytest_module);
+    }
+
+    //ǰܽngx_http_fanout_startNGX_AGAIN
+    return rc;
+}
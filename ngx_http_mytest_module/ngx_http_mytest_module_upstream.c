@@ -6,12 +6,18 @@
 typedef struct
 {
     ngx_http_status_t           status;
-    ngx_str_t					backendServer;
+    ngx_http_chunked_t          chunked;
 } ngx_http_mytest_ctx_t;
 
 typedef struct
 {
     ngx_http_upstream_conf_t upstream;
+    ngx_str_t                host;
+
+    /* "mytest;": resolved at start, unless a resolver is configured */
+    ngx_addr_t              *addrs;
+    ngx_uint_t               naddrs;
+    ngx_uint_t               next;
 } ngx_http_mytest_conf_t;
 
 
@@ -26,6 +32,14 @@ static ngx_int_t
 mytest_upstream_process_header(ngx_http_request_t *r);
 static ngx_int_t
 mytest_process_status_line(ngx_http_request_t *r);
+static ngx_int_t
+mytest_upstream_reinit_request(ngx_http_request_t *r);
+static ngx_int_t
+mytest_upstream_input_filter_init(void *data);
+static ngx_int_t
+mytest_upstream_non_buffered_filter(void *data, ssize_t bytes);
+static ngx_int_t
+mytest_upstream_non_buffered_chunked_filter(void *data, ssize_t bytes);
 
 
 static ngx_str_t  ngx_http_proxy_hide_headers[] =
@@ -47,7 +61,7 @@ static ngx_command_t  ngx_http_mytest_commands[] =
 
     {
         ngx_string("mytest"),
-        NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_HTTP_LMT_CONF | NGX_CONF_NOARGS,
+        NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_HTTP_LMT_CONF | NGX_CONF_NOARGS | NGX_CONF_TAKE1,
         ngx_http_mytest,
         NGX_HTTP_LOC_CONF_OFFSET,
         0,
@@ -138,6 +152,15 @@ static char *ngx_http_mytest_merge_loc_conf(ngx_conf_t *cf, void *parent, void *
     ngx_http_mytest_conf_t *conf = (ngx_http_mytest_conf_t *)child;
 
     ngx_hash_init_t             hash;
+
+    if (conf->upstream.upstream == NULL && conf->host.data == NULL)
+    {
+        conf->upstream.upstream = prev->upstream.upstream;
+        conf->host = prev->host;
+        conf->addrs = prev->addrs;
+        conf->naddrs = prev->naddrs;
+    }
+
     hash.max_size = 100;
     hash.bucket_size = 1024;
     hash.name = "proxy_headers_hash";
@@ -155,25 +178,34 @@ static char *ngx_http_mytest_merge_loc_conf(ngx_conf_t *cf, void *parent, void *
 static ngx_int_t
 mytest_upstream_create_request(ngx_http_request_t *r)
 {
-    //googleηܼ򵥣ģ
-///search?q=URLbackendQueryLineе%Vת
-//ʽ÷μ4.4еı4-7
-    static ngx_str_t backendQueryLine =
-        ngx_string("GET /search?q=%V HTTP/1.1\r\nHost: www.google.com\r\nConnection: close\r\n\r\n");
-    ngx_int_t queryLineLen = backendQueryLine.len + r->args.len - 2;
+    size_t                   len;
+    ngx_buf_t               *b;
+    ngx_http_mytest_conf_t  *mycf;
+
+    //ηܼ򵥣ģ
+///search?q=URL
+    mycf = ngx_http_get_module_loc_conf(r, ngx_http_mytest_module);
+
+    /* HTTP/1.1 without "Connection: close" lets upstream keepalive reuse it */
+    len = sizeof("GET /search?q= HTTP/1.1" CRLF "Host: " CRLF CRLF) - 1
+          + r->args.len + mycf->host.len;
+
     //ڴڴ棬ôѵ£
 //ʱҪepollεsendͲɣ
 //ʱ뱣֤ڴ治ᱻͷţʱڴᱻԶͷţ
 //ڴй©Ŀ
-    ngx_buf_t* b = ngx_create_temp_buf(r->pool, queryLineLen);
+    b = ngx_create_temp_buf(r->pool, len);
     if (b == NULL)
         return NGX_ERROR;
-    //lastҪָĩβ
-    b->last = b->pos + queryLineLen;
 
-    //൱snprintfֻ֧4.4еı4-7гתʽ
-    ngx_snprintf(b->pos, queryLineLen ,
-                 (char*)backendQueryLine.data, &r->args);
+    b->last = ngx_cpymem(b->last, "GET /search?q=", sizeof("GET /search?q=") - 1);
+    b->last = ngx_cpymem(b->last, r->args.data, r->args.len);
+    b->last = ngx_cpymem(b->last, " HTTP/1.1" CRLF "Host: ",
+                         sizeof(" HTTP/1.1" CRLF "Host: ") - 1);
+    b->last = ngx_cpymem(b->last, mycf->host.data, mycf->host.len);
+    *b->last++ = CR; *b->last++ = LF;
+    *b->last++ = CR; *b->last++ = LF;
+
     // r->upstream->request_bufsһngx_chain_tṹҪ
 //͸η
     r->upstream->request_bufs = ngx_alloc_chain_link(r->pool);
@@ -191,6 +223,26 @@ mytest_upstream_create_request(ngx_http_request_t *r)
     return NGX_OK;
 }
 
+static ngx_int_t
+mytest_upstream_reinit_request(ngx_http_request_t *r)
+{
+    ngx_http_mytest_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_mytest_module);
+    if (ctx == NULL)
+    {
+        return NGX_OK;
+    }
+
+    /* the next upstream server starts from the status line again */
+    ngx_memzero(&ctx->status, sizeof(ngx_http_status_t));
+    ngx_memzero(&ctx->chunked, sizeof(ngx_http_chunked_t));
+
+    r->upstream->process_header = mytest_process_status_line;
+
+    return NGX_OK;
+}
+
 static ngx_int_t
 mytest_process_status_line(ngx_http_request_t *r)
 {
@@ -224,6 +276,7 @@ mytest_process_status_line(ngx_http_request_t *r)
 
         r->http_version = NGX_HTTP_VERSION_9;
         u->state->status = NGX_HTTP_OK;
+        u->headers_in.connection_close = 1;
 
         return NGX_OK;
     }
@@ -254,6 +307,11 @@ mytest_process_status_line(ngx_http_request_t *r)
 
     ngx_memcpy(u->headers_in.status_line.data, ctx->status.start, len);
 
+    if (ctx->status.http_version < NGX_HTTP_VERSION_11)
+    {
+        u->headers_in.connection_close = 1;
+    }
+
     //һʼhttpͷprocess_headerصΪ
 //mytest_upstream_process_header
 //֮յַmytest_upstream_process_header
@@ -391,6 +449,180 @@ mytest_upstream_process_header(ngx_http_request_t *r)
     }
 }
 
+/*
+ * buffering is off, so the body goes through the non-buffered filters:
+ * they find where the response ends and only then allow u->keepalive
+ */
+static ngx_int_t
+mytest_upstream_input_filter_init(void *data)
+{
+    ngx_http_request_t   *r = data;
+    ngx_http_upstream_t  *u;
+
+    u = r->upstream;
+
+    if (u->headers_in.status_n == NGX_HTTP_NO_CONTENT
+        || u->headers_in.status_n == NGX_HTTP_NOT_MODIFIED
+        || u->headers_in.content_length_n == 0)
+    {
+        u->length = 0;
+        u->keepalive = !u->headers_in.connection_close;
+    }
+    else if (u->headers_in.chunked)
+    {
+        u->input_filter = mytest_upstream_non_buffered_chunked_filter;
+        u->length = 1;
+    }
+    else
+    {
+        /* content length or connection close */
+        u->length = u->headers_in.content_length_n;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+mytest_upstream_non_buffered_filter(void *data, ssize_t bytes)
+{
+    ngx_http_request_t   *r = data;
+
+    ngx_buf_t            *b;
+    ngx_chain_t          *cl, **ll;
+    ngx_http_upstream_t  *u;
+
+    u = r->upstream;
+
+    for (cl = u->out_bufs, ll = &u->out_bufs; cl; cl = cl->next)
+    {
+        ll = &cl->next;
+    }
+
+    cl = ngx_chain_get_free_buf(r->pool, &u->free_bufs);
+    if (cl == NULL)
+    {
+        return NGX_ERROR;
+    }
+
+    *ll = cl;
+
+    cl->buf->flush = 1;
+    cl->buf->memory = 1;
+
+    b = &u->buffer;
+
+    cl->buf->pos = b->last;
+    b->last += bytes;
+    cl->buf->last = b->last;
+    cl->buf->tag = u->output.tag;
+
+    if (u->length == -1)
+    {
+        return NGX_OK;
+    }
+
+    u->length -= bytes;
+
+    if (u->length == 0)
+    {
+        u->keepalive = !u->headers_in.connection_close;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+mytest_upstream_non_buffered_chunked_filter(void *data, ssize_t bytes)
+{
+    ngx_http_request_t     *r = data;
+
+    ngx_int_t               rc;
+    ngx_buf_t              *b, *buf;
+    ngx_chain_t            *cl, **ll;
+    ngx_http_upstream_t    *u;
+    ngx_http_mytest_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_mytest_module);
+    if (ctx == NULL)
+    {
+        return NGX_ERROR;
+    }
+
+    u = r->upstream;
+    buf = &u->buffer;
+
+    buf->pos = buf->last;
+    buf->last += bytes;
+
+    for (cl = u->out_bufs, ll = &u->out_bufs; cl; cl = cl->next)
+    {
+        ll = &cl->next;
+    }
+
+    for ( ;; )
+    {
+        rc = ngx_http_parse_chunked(r, buf, &ctx->chunked);
+
+        if (rc == NGX_OK)
+        {
+            cl = ngx_chain_get_free_buf(r->pool, &u->free_bufs);
+            if (cl == NULL)
+            {
+                return NGX_ERROR;
+            }
+
+            *ll = cl;
+            ll = &cl->next;
+
+            b = cl->buf;
+
+            b->flush = 1;
+            b->memory = 1;
+
+            b->pos = buf->pos;
+            b->tag = u->output.tag;
+
+            if (buf->last - buf->pos >= ctx->chunked.size)
+            {
+                buf->pos += (size_t) ctx->chunked.size;
+                b->last = buf->pos;
+                ctx->chunked.size = 0;
+            }
+            else
+            {
+                ctx->chunked.size -= buf->last - buf->pos;
+                buf->pos = buf->last;
+                b->last = buf->last;
+            }
+
+            continue;
+        }
+
+        if (rc == NGX_DONE)
+        {
+            u->keepalive = !u->headers_in.connection_close;
+            u->length = 0;
+
+            break;
+        }
+
+        if (rc == NGX_AGAIN)
+        {
+            break;
+        }
+
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "upstream sent invalid chunked response");
+
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
 static void
 mytest_upstream_finalize_request(ngx_http_request_t *r, ngx_int_t rc)
 {
@@ -402,8 +634,66 @@ mytest_upstream_finalize_request(ngx_http_request_t *r, ngx_int_t rc)
 static char *
 ngx_http_mytest(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
+    ngx_http_mytest_conf_t    *mycf = conf;
+
+    ngx_str_t                 *value;
+    ngx_url_t                  u;
     ngx_http_core_loc_conf_t  *clcf;
 
+    if (mycf->upstream.upstream || mycf->host.data)
+    {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (cf->args->nelts == 1)
+    {
+        /*
+         * resolved here, as proxy_pass does with a static host; the
+         * "resolver" of the location, if any, looks it up per request
+         */
+        ngx_memzero(&u, sizeof(ngx_url_t));
+
+        ngx_str_set(&u.url, "www.google.com");
+        u.default_port = 80;
+
+        if (ngx_parse_url(cf->pool, &u) != NGX_OK)
+        {
+            if (u.err)
+            {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "%s in \"%V\"", u.err, &u.url);
+            }
+
+            return NGX_CONF_ERROR;
+        }
+
+        mycf->host = u.host;
+        mycf->addrs = u.addrs;
+        mycf->naddrs = u.naddrs;
+    }
+    else
+    {
+        /*
+         * "mytest backend;" uses upstream backend {} (round robin,
+         * keepalive) or resolves a static host once at start
+         */
+        ngx_memzero(&u, sizeof(ngx_url_t));
+
+        u.url = value[1];
+        u.default_port = 80;
+        u.no_resolve = 1;
+
+        mycf->upstream.upstream = ngx_http_upstream_add(cf, &u, 0);
+        if (mycf->upstream.upstream == NULL)
+        {
+            return NGX_CONF_ERROR;
+        }
+
+        mycf->host = u.host;
+    }
+
     //ҵmytestÿ飬clcfòlocationڵ
 //ṹʵȻmainsrvlocҲ˵ÿ
 //http{}server{}Ҳһngx_http_core_loc_conf_tṹ
@@ -421,11 +711,14 @@ ngx_http_mytest(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 static ngx_int_t
 ngx_http_mytest_handler(ngx_http_request_t *r)
 {
+    ngx_addr_t                *addr;
+    ngx_http_core_loc_conf_t  *clcf;
+
     //ȽhttpĽṹngx_http_mytest_ctx_t
     ngx_http_mytest_ctx_t* myctx = ngx_http_get_module_ctx(r, ngx_http_mytest_module);
     if (myctx == NULL)
     {
-        myctx = ngx_palloc(r->pool, sizeof(ngx_http_mytest_ctx_t));
+        myctx = ngx_pcalloc(r->pool, sizeof(ngx_http_mytest_ctx_t));
         if (myctx == NULL)
         {
             return NGX_ERROR;
@@ -449,43 +742,45 @@ ngx_http_mytest_handler(ngx_http_request_t *r)
     //תʱʹõĻ
     u->buffering = mycf->upstream.buffering;
 
-    //´뿪ʼʼresolvedṹ壬ηĵַ
-    u->resolved = (ngx_http_upstream_resolved_t*) ngx_pcalloc(r->pool, sizeof(ngx_http_upstream_resolved_t));
-    if (u->resolved == NULL)
-    {
-        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                      "ngx_pcalloc resolved error. %s.", strerror(errno));
-        return NGX_ERROR;
-    }
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
-    //ηwww.google.com
-    static struct sockaddr_in backendSockAddr;
-    struct hostent *pHost = gethostbyname((char*) "www.google.com");
-    if (pHost == NULL)
+    if (mycf->upstream.upstream == NULL)
     {
-        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                      "gethostbyname fail. %s", strerror(errno));
+        //´뿪ʼʼresolvedṹ壬ηĵַ
+        u->resolved = (ngx_http_upstream_resolved_t*) ngx_pcalloc(r->pool, sizeof(ngx_http_upstream_resolved_t));
+        if (u->resolved == NULL)
+        {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "ngx_pcalloc resolved error. %s.", strerror(errno));
+            return NGX_ERROR;
+        }
 
-        return NGX_ERROR;
-    }
+        u->resolved->host = mycf->host;
+        u->resolved->port = 80;
 
-    //η80˿
-    backendSockAddr.sin_family = AF_INET;
-    backendSockAddr.sin_port = htons((in_port_t) 80);
-    char* pDmsIP = inet_ntoa(*(struct in_addr*) (pHost->h_addr_list[0]));
-    backendSockAddr.sin_addr.s_addr = inet_addr(pDmsIP);
-    myctx->backendServer.data = (u_char*)pDmsIP;
-    myctx->backendServer.len = strlen(pDmsIP);
+        /*
+         * with a "resolver" and no sockaddr ngx_http_upstream_init_request()
+         * looks the host up, answers are cached there; otherwise the
+         * addresses found at start are taken in turn
+         */
+        if (clcf->resolver == NULL || clcf->resolver->connections.nelts == 0)
+        {
+            addr = &mycf->addrs[mycf->next++ % mycf->naddrs];
 
-    //ַõresolvedԱ
-    u->resolved->sockaddr = (struct sockaddr *)&backendSockAddr;
-    u->resolved->socklen = sizeof(struct sockaddr_in);
-    u->resolved->naddrs = 1;
+            u->resolved->sockaddr = addr->sockaddr;
+            u->resolved->socklen = addr->socklen;
+            u->resolved->naddrs = 1;
+        }
+    }
 
     //ʵֵĻصҲ5.3.35.3.5ʵֵ3
     u->create_request = mytest_upstream_create_request;
     u->process_header = mytest_process_status_line;
+    u->reinit_request = mytest_upstream_reinit_request;
     u->finalize_request = mytest_upstream_finalize_request;
+    u->input_filter_init = mytest_upstream_input_filter_init;
+    u->input_filter = mytest_upstream_non_buffered_filter;
+    u->input_filter_ctx = r;
 
     //뽫countԱ1ɼ5.1.5
     r->main->count++;
@@ -52,6 +52,9 @@ struct ngx_buf_s {
     unsigned         last_shadow:1;
     unsigned         temp_file:1;
 
+    /* the memory is still referenced by a MSG_ZEROCOPY send */
+    unsigned         zerocopy:1;
+
     /* STUB */ int   num;
 };
 
@@ -86,6 +86,10 @@ ngx_create_listening(ngx_conf_t *cf, void *sockaddr, socklen_t socklen)
     ls->fastopen = -1;
 #endif
 
+#if (NGX_HAVE_SO_BUSY_POLL)
+    ls->busy_poll = -1;
+#endif
+
     return ls;
 }
 
@@ -127,6 +131,110 @@ ngx_clone_listening(ngx_conf_t *cf, ngx_listening_t *ls)
 }
 
 
+#if (NGX_HAVE_REUSEPORT_CBPF)
+
+/*
+ * attaches a program to the reuseport group of the listening socket which
+ * selects the socket of the worker process bound to the CPU the connection
+ * is received on; the sockets of a group are indexed in the order they
+ * were opened, that is, by ls->worker
+ *
+ * the program is rebuilt by each new cycle for its number of workers, and
+ * an index the table does not give is the CPU number modulo that number,
+ * so the index always stays within the group
+ */
+
+ngx_int_t
+ngx_steer_listening(ngx_cycle_t *cycle, ngx_listening_t *ls)
+{
+    int                  rc;
+    ngx_uint_t           n, w, cpu, len, table;
+    ngx_cpuset_t        *mask;
+    ngx_core_conf_t     *ccf;
+    struct sock_fprog    prog;
+    struct sock_filter  *code;
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    n = ccf->worker_processes;
+
+    /* the load of the CPU number, the modulo, and the return */
+
+    len = 3;
+    table = 0;
+
+    for (w = 0; w < n; w++) {
+        mask = ngx_get_cpu_affinity(w);
+
+        if (mask == NULL) {
+            table = 0;
+            break;
+        }
+
+        table += 2 * CPU_COUNT(mask);
+    }
+
+    if (len + table > BPF_MAXINSNS) {
+        table = 0;
+    }
+
+    len += table;
+
+    code = ngx_alloc(len * sizeof(struct sock_filter), cycle->log);
+    if (code == NULL) {
+        return NGX_ERROR;
+    }
+
+    prog.len = len;
+    prog.filter = code;
+
+    *code++ = (struct sock_filter)
+              BPF_STMT(BPF_LD|BPF_W|BPF_ABS, SKF_AD_OFF + SKF_AD_CPU);
+
+    if (table) {
+
+        for (w = 0; w < n; w++) {
+            mask = ngx_get_cpu_affinity(w);
+
+            for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (!CPU_ISSET(cpu, mask)) {
+                    continue;
+                }
+
+                *code++ = (struct sock_filter)
+                          BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, cpu, 0, 1);
+                *code++ = (struct sock_filter) BPF_STMT(BPF_RET|BPF_K, w);
+            }
+        }
+    }
+
+    /* no affinity or a CPU no worker is bound to */
+
+    *code++ = (struct sock_filter) BPF_STMT(BPF_ALU|BPF_MOD|BPF_K, n);
+    *code = (struct sock_filter) BPF_STMT(BPF_RET|BPF_A, 0);
+
+    rc = setsockopt(ls->fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                    (const void *) &prog, sizeof(struct sock_fprog));
+
+    ngx_free(prog.filter);
+
+    if (rc == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                      "setsockopt(SO_ATTACH_REUSEPORT_CBPF) %V failed, "
+                      "ignored", &ls->addr_text);
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, cycle->log, 0,
+                   "reuseport program of %ui instructions attached to %V",
+                   len, &ls->addr_text);
+
+    return NGX_OK;
+}
+
+#endif
+
+
 ngx_int_t
 ngx_set_inherited_sockets(ngx_cycle_t *cycle)
 {
@@ -750,6 +858,22 @@ ngx_configure_listening_sockets(ngx_cycle_t *cycle)
         }
 #endif
 
+#if (NGX_HAVE_SO_BUSY_POLL)
+        if (ls[i].busy_poll != -1) {
+
+            /* the accepted sockets inherit it from the listening one */
+
+            if (setsockopt(ls[i].fd, SOL_SOCKET, SO_BUSY_POLL,
+                           (const void *) &ls[i].busy_poll, sizeof(int))
+                == -1)
+            {
+                ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                              "setsockopt(SO_BUSY_POLL, %d) %V failed, ignored",
+                              ls[i].busy_poll, &ls[i].addr_text);
+            }
+        }
+#endif
+
 #if 0
         if (1) {
             int tcp_nodelay = 1;
@@ -1037,6 +1161,12 @@ ngx_close_connection(ngx_connection_t *c)
         return;
     }
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+    if (c->zerocopy && c->zerocopy->nbufs) {
+        ngx_zerocopy_abort(c);
+    }
+#endif
+
     if (c->read->timer_set) {
         ngx_del_timer(c->read);
     }
@@ -15,6 +15,23 @@
 
 typedef struct ngx_listening_s  ngx_listening_t;
 
+
+#if (NGX_STAT_ACCEPT)
+
+typedef struct {
+    ngx_atomic_t        accepted;
+    ngx_atomic_t        loops;      /* accept handler calls */
+    ngx_atomic_t        empty;      /* calls that accepted nothing */
+    ngx_atomic_t        limited;    /* calls stopped by accept_batch */
+    ngx_atomic_t        max_batch;  /* most connections in one call */
+
+    /* the accept queue, sampled when a call is stopped by accept_batch */
+    ngx_atomic_t        max_queue;
+    ngx_atomic_t        full;
+} ngx_listening_stat_t;
+
+#endif
+
 struct ngx_listening_s {
     ngx_socket_t        fd; //socket套接字句柄
 
@@ -53,6 +70,10 @@ struct ngx_listening_s {
 
     ngx_uint_t          worker;
 
+#if (NGX_STAT_ACCEPT)
+    ngx_listening_stat_t  *stat;
+#endif
+
     unsigned            open:1;
     unsigned            remain:1;
     unsigned            ignore:1;
@@ -71,6 +92,9 @@ struct ngx_listening_s {
 #if (NGX_HAVE_REUSEPORT)
     unsigned            reuseport:1;
     unsigned            add_reuseport:1;
+#endif
+#if (NGX_HAVE_REUSEPORT_CBPF)
+    unsigned            incoming_cpu:1;
 #endif
     unsigned            keepalive:2;
 
@@ -90,6 +114,10 @@ struct ngx_listening_s {
     int                 fastopen;
 #endif
 
+#if (NGX_HAVE_SO_BUSY_POLL)
+    int                 busy_poll;
+#endif
+
 };
 
 
@@ -119,6 +147,7 @@ typedef enum {
 #define NGX_LOWLEVEL_BUFFERED  0x0f
 #define NGX_SSL_BUFFERED       0x01
 #define NGX_HTTP_V2_BUFFERED   0x02
+#define NGX_ZEROCOPY_BUFFERED  0x04
 
 
 struct ngx_connection_s {
@@ -193,6 +222,10 @@ struct ngx_connection_s {
 #if (NGX_THREADS)
     ngx_thread_task_t  *sendfile_task;
 #endif
+
+#if (NGX_HAVE_MSG_ZEROCOPY)
+    ngx_zerocopy_t     *zerocopy;
+#endif
 };
 
 
@@ -210,6 +243,9 @@ struct ngx_connection_s {
 ngx_listening_t *ngx_create_listening(ngx_conf_t *cf, void *sockaddr,
     socklen_t socklen);
 ngx_int_t ngx_clone_listening(ngx_conf_t *cf, ngx_listening_t *ls);
+#if (NGX_HAVE_REUSEPORT_CBPF)
+ngx_int_t ngx_steer_listening(ngx_cycle_t *cycle, ngx_listening_t *ls);
+#endif
 ngx_int_t ngx_set_inherited_sockets(ngx_cycle_t *cycle);
 ngx_int_t ngx_open_listening_sockets(ngx_cycle_t *cycle);
 void ngx_configure_listening_sockets(ngx_cycle_t *cycle);
@@ -90,6 +90,8 @@ typedef struct {
      ngx_int_t                rlimit_nofile;
      off_t                    rlimit_core;
 
+     size_t                   pool_cache;
+
      int                      priority;
 
      ngx_uint_t               cpu_affinity_auto;
@@ -13,6 +13,20 @@
 #include <ngx_core.h>
 
 
+#if (NGX_HAVE_FILE_READAHEAD)
+
+/* set up by ngx_http_set_file_readahead(), a zero size disables the hints */
+
+typedef struct {
+    size_t                     size;
+    off_t                      next;
+    off_t                      last;
+    unsigned                   drop:1;
+} ngx_file_readahead_t;
+
+#endif
+
+
 struct ngx_file_s {
     ngx_fd_t                   fd;
     ngx_str_t                  name;
@@ -33,6 +47,10 @@ struct ngx_file_s {
     ngx_event_aio_t           *aio;
 #endif
 
+#if (NGX_HAVE_FILE_READAHEAD)
+    ngx_file_readahead_t       readahead;
+#endif
+
     unsigned                   valid_info:1;
     unsigned                   directio:1;
 };
@@ -9,6 +9,28 @@
 #include <ngx_core.h>
 
 
+#if (NGX_HASH_COMPACT)
+
+#if (NGX_HAVE_SSE2)
+#include <emmintrin.h>
+#endif
+
+/*
+ * With --with-compact-hash a hash is an open addressing table probed by
+ * groups of 16 slots.  Each slot has a one-byte tag, 0 for an empty slot,
+ * so a group is matched in one SSE2 compare; keys are stored out of line.
+ * The tables are at most half full, the probe stops at the first group
+ * with an empty slot.
+ */
+
+#define ngx_hash_compact_mix(key)  ((uint32_t) ((key) * 2654435761U))
+#define ngx_hash_compact_tag(h)    ((u_char) (0x80 | ((h) & 0x7f)))
+#define ngx_hash_compact_group(h)  ((ngx_uint_t) (h) >> 7)
+
+static ngx_inline ngx_uint_t ngx_hash_compact_match(u_char *tags, u_char tag);
+
+#else
+
 void *
 ngx_hash_find(ngx_hash_t *hash, ngx_uint_t key, u_char *name, size_t len)
 {
@@ -48,6 +70,8 @@ ngx_hash_find(ngx_hash_t *hash, ngx_uint_t key, u_char *name, size_t len)
     return NULL;
 }
 
+#endif
+
 
 void *
 ngx_hash_find_wc_head(ngx_hash_wildcard_t *hwc, u_char *name, size_t len)
@@ -245,6 +269,8 @@ ngx_hash_find_combined(ngx_hash_combined_t *hash, ngx_uint_t key, u_char *name,
 }
 
 
+#if !(NGX_HASH_COMPACT)
+
 #define NGX_HASH_ELT_SIZE(name)                                               \
     (sizeof(void *) + ngx_align((name)->key.len + 2, sizeof(void *)))
 
@@ -461,6 +487,8 @@ found:
     return NGX_OK;
 }
 
+#endif
+
 
 ngx_int_t
 ngx_hash_wildcard_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
@@ -987,3 +1015,173 @@ wildcard:
 
     return NGX_OK;
 }
+
+
+#if (NGX_HASH_COMPACT)
+
+void *
+ngx_hash_find(ngx_hash_t *hash, ngx_uint_t key, u_char *name, size_t len)
+{
+    u_char            tag;
+    uint32_t          h;
+    ngx_uint_t        g, i, mask, bits;
+    ngx_hash_celt_t  *elt;
+
+    if (hash->tags == NULL) {
+        return NULL;
+    }
+
+    h = ngx_hash_compact_mix(key);
+    tag = ngx_hash_compact_tag(h);
+
+    mask = (hash->size >> 4) - 1;
+    g = ngx_hash_compact_group(h) & mask;
+
+    for ( ;; ) {
+
+        bits = ngx_hash_compact_match(&hash->tags[g << 4], tag);
+
+        for (i = 0; bits; i++, bits >>= 1) {
+            if (!(bits & 1)) {
+                continue;
+            }
+
+            elt = &hash->elts[(g << 4) + i];
+
+            if (elt->len == len && ngx_memcmp(elt->name, name, len) == 0) {
+                return elt->value;
+            }
+        }
+
+        if (ngx_hash_compact_match(&hash->tags[g << 4], 0)) {
+            return NULL;
+        }
+
+        g = (g + 1) & mask;
+    }
+}
+
+
+ngx_int_t
+ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
+{
+    u_char           *tags, *p;
+    size_t            len;
+    uint32_t          h;
+    ngx_uint_t        i, n, g, size, mask, bits;
+    ngx_hash_elt_t  **buckets;
+    ngx_hash_celt_t  *elts;
+
+    len = 0;
+    n = 0;
+
+    for (i = 0; i < nelts; i++) {
+        if (names[i].key.data == NULL) {
+            continue;
+        }
+
+        len += names[i].key.len;
+        n++;
+    }
+
+    for (size = 16; size < 2 * n; size <<= 1) { /* void */ }
+
+    if (hinit->hash == NULL) {
+        hinit->hash = ngx_pcalloc(hinit->pool, sizeof(ngx_hash_wildcard_t));
+        if (hinit->hash == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    tags = ngx_pcalloc(hinit->pool, size);
+    if (tags == NULL) {
+        return NGX_ERROR;
+    }
+
+    elts = ngx_pcalloc(hinit->pool, size * sizeof(ngx_hash_celt_t));
+    if (elts == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_pnalloc(hinit->pool, len + 1);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    mask = (size >> 4) - 1;
+
+    for (i = 0; i < nelts; i++) {
+        if (names[i].key.data == NULL) {
+            continue;
+        }
+
+        h = ngx_hash_compact_mix(names[i].key_hash);
+        g = ngx_hash_compact_group(h) & mask;
+
+        for ( ;; ) {
+            bits = ngx_hash_compact_match(&tags[g << 4], 0);
+
+            if (bits) {
+                break;
+            }
+
+            g = (g + 1) & mask;
+        }
+
+        for (n = 0; !(bits & 1); n++, bits >>= 1) { /* void */ }
+
+        n += g << 4;
+
+        tags[n] = ngx_hash_compact_tag(h);
+
+        elts[n].value = names[i].value;
+        elts[n].name = p;
+        elts[n].len = names[i].key.len;
+
+        ngx_strlow(p, names[i].key.data, names[i].key.len);
+        p += names[i].key.len;
+    }
+
+    /* the buckets are only tested for NULL outside of ngx_hash.c */
+
+    buckets = (ngx_hash_elt_t **) tags;
+
+    hinit->hash->buckets = buckets;
+    hinit->hash->size = size;
+    hinit->hash->tags = tags;
+    hinit->hash->elts = elts;
+
+    return NGX_OK;
+}
+
+
+static ngx_inline ngx_uint_t
+ngx_hash_compact_match(u_char *tags, u_char tag)
+{
+#if (NGX_HAVE_SSE2)
+
+    __m128i  group;
+
+    group = _mm_loadu_si128((__m128i *) tags);
+
+    return (ngx_uint_t) _mm_movemask_epi8(
+                            _mm_cmpeq_epi8(group, _mm_set1_epi8((char) tag)));
+
+#else
+
+    ngx_uint_t  i, bits;
+
+    bits = 0;
+
+    for (i = 0; i < 16; i++) {
+        if (tags[i] == tag) {
+            bits |= (ngx_uint_t) 1 << i;
+        }
+    }
+
+    return bits;
+
+#endif
+}
+
+#endif
@@ -20,9 +20,24 @@ typedef struct {
 } ngx_hash_elt_t;
 
 
+#if (NGX_HASH_COMPACT)
+
+typedef struct {
+    void             *value;
+    u_char           *name;
+    size_t            len;
+} ngx_hash_celt_t;
+
+#endif
+
+
 typedef struct {
     ngx_hash_elt_t  **buckets;
     ngx_uint_t        size;
+#if (NGX_HASH_COMPACT)
+    u_char           *tags;
+    ngx_hash_celt_t  *elts;
+#endif
 } ngx_hash_t;
 
 
@@ -8,6 +8,9 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_event.h>
+#if (NGX_THREADS)
+#include <ngx_thread_pool.h>
+#endif
 
 
 /*
@@ -21,6 +24,22 @@
 #define NGX_MIN_READ_AHEAD  (128 * 1024)
 
 
+#if (NGX_THREADS)
+
+typedef struct {
+    ngx_str_t                name;
+    ngx_fd_t                 fd;
+    ngx_file_uniq_t          uniq;
+
+    ngx_open_file_info_t     of;
+    ngx_int_t                rc;
+
+    unsigned                 opened:1;
+} ngx_thread_open_file_ctx_t;
+
+#endif
+
+
 static void ngx_open_file_cache_cleanup(void *data);
 #if (NGX_HAVE_OPENAT)
 static ngx_fd_t ngx_openat_file_owner(ngx_fd_t at_fd, const u_char *name,
@@ -35,8 +54,16 @@ static ngx_fd_t ngx_open_file_wrapper(ngx_str_t *name,
     ngx_int_t access, ngx_log_t *log);
 static ngx_int_t ngx_file_info_wrapper(ngx_str_t *name,
     ngx_open_file_info_t *of, ngx_file_info_t *fi, ngx_log_t *log);
+static ngx_int_t ngx_open_and_stat(ngx_str_t *name,
+    ngx_open_file_info_t *of, ngx_pool_t *pool);
 static ngx_int_t ngx_open_and_stat_file(ngx_str_t *name,
     ngx_open_file_info_t *of, ngx_log_t *log);
+#if (NGX_THREADS)
+static ngx_int_t ngx_thread_open_and_stat_file(ngx_str_t *name,
+    ngx_open_file_info_t *of, ngx_pool_t *pool);
+static void ngx_thread_open_and_stat_file_handler(void *data, ngx_log_t *log);
+static void ngx_thread_open_file_cleanup(void *data);
+#endif
 static void ngx_open_file_add_event(ngx_open_file_cache_t *cache,
     ngx_cached_open_file_t *file, ngx_open_file_info_t *of, ngx_log_t *log);
 static void ngx_open_file_cleanup(void *data);
@@ -183,7 +210,7 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
             return NGX_ERROR;
         }
 
-        rc = ngx_open_and_stat_file(name, of, pool->log);
+        rc = ngx_open_and_stat(name, of, pool);
 
         if (rc == NGX_OK && !of->is_dir) {
             cln->handler = ngx_pool_cleanup_file;
@@ -218,7 +245,11 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
 
             /* file was not used often enough to keep open */
 
-            rc = ngx_open_and_stat_file(name, of, pool->log);
+            rc = ngx_open_and_stat(name, of, pool);
+
+            if (rc == NGX_AGAIN) {
+                goto again;
+            }
 
             if (rc != NGX_OK && (of->err == 0 || !of->errors)) {
                 goto failed;
@@ -286,7 +317,11 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
         of->fd = file->fd;
         of->uniq = file->uniq;
 
-        rc = ngx_open_and_stat_file(name, of, pool->log);
+        rc = ngx_open_and_stat(name, of, pool);
+
+        if (rc == NGX_AGAIN) {
+            goto again;
+        }
 
         if (rc != NGX_OK && (of->err == 0 || !of->errors)) {
             goto failed;
@@ -351,7 +386,11 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
 
     /* not found */
 
-    rc = ngx_open_and_stat_file(name, of, pool->log);
+    rc = ngx_open_and_stat(name, of, pool);
+
+    if (rc == NGX_AGAIN) {
+        goto again;
+    }
 
     if (rc != NGX_OK && (of->err == 0 || !of->errors)) {
         goto failed;
@@ -450,6 +489,20 @@ found:
 
     return NGX_ERROR;
 
+again:
+
+    /*
+     * the file is opened in a thread, and it is looked up once again
+     * when the request is resumed
+     */
+
+    if (file) {
+        file->uses--;
+        ngx_queue_insert_head(&cache->expire_queue, &file->queue);
+    }
+
+    return NGX_AGAIN;
+
 failed:
 
     if (file) {
@@ -836,6 +889,21 @@ ngx_file_info_wrapper(ngx_str_t *name, ngx_open_file_info_t *of,
 }
 
 
+static ngx_int_t
+ngx_open_and_stat(ngx_str_t *name, ngx_open_file_info_t *of, ngx_pool_t *pool)
+{
+#if (NGX_THREADS)
+
+    if (of->thread_handler) {
+        return ngx_thread_open_and_stat_file(name, of, pool);
+    }
+
+#endif
+
+    return ngx_open_and_stat_file(name, of, pool->log);
+}
+
+
 static ngx_int_t
 ngx_open_and_stat_file(ngx_str_t *name, ngx_open_file_info_t *of,
     ngx_log_t *log)
@@ -945,6 +1013,129 @@ done:
 }
 
 
+#if (NGX_THREADS)
+
+static ngx_int_t
+ngx_thread_open_and_stat_file(ngx_str_t *name, ngx_open_file_info_t *of,
+    ngx_pool_t *pool)
+{
+    ngx_thread_task_t           *task;
+    ngx_pool_cleanup_t          *cln;
+    ngx_thread_open_file_ctx_t  *ctx;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, pool->log, 0,
+                   "thread open: \"%V\", fd:%d", name, of->fd);
+
+    task = of->thread_task;
+
+    if (task == NULL) {
+        task = ngx_thread_task_alloc(pool, sizeof(ngx_thread_open_file_ctx_t));
+        if (task == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln = ngx_pool_cleanup_add(pool, 0);
+        if (cln == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln->handler = ngx_thread_open_file_cleanup;
+        cln->data = task->ctx;
+
+        task->handler = ngx_thread_open_and_stat_file_handler;
+
+        of->thread_task = task;
+    }
+
+    ctx = task->ctx;
+
+    if (task->event.complete) {
+        task->event.complete = 0;
+
+        /*
+         * the result is used only if the lookup is the same as the one
+         * the task was posted for, otherwise the file is opened again
+         */
+
+        if (ctx->name.len == name->len
+            && ngx_strncmp(ctx->name.data, name->data, name->len) == 0
+            && ctx->fd == of->fd
+            && ctx->uniq == of->uniq)
+        {
+            of->fd = ctx->of.fd;
+            of->uniq = ctx->of.uniq;
+            of->mtime = ctx->of.mtime;
+            of->size = ctx->of.size;
+            of->fs_size = ctx->of.fs_size;
+            of->err = ctx->of.err;
+            of->failed = ctx->of.failed;
+
+            of->is_dir = ctx->of.is_dir;
+            of->is_file = ctx->of.is_file;
+            of->is_link = ctx->of.is_link;
+            of->is_exec = ctx->of.is_exec;
+            of->is_directio = ctx->of.is_directio;
+
+            ctx->opened = 0;
+
+            return ctx->rc;
+        }
+
+        ngx_thread_open_file_cleanup(ctx);
+    }
+
+    ctx->name = *name;
+    ctx->fd = of->fd;
+    ctx->uniq = of->uniq;
+    ctx->of = *of;
+
+    if (of->thread_handler(task, of) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return NGX_AGAIN;
+}
+
+
+static void
+ngx_thread_open_and_stat_file_handler(void *data, ngx_log_t *log)
+{
+    ngx_thread_open_file_ctx_t *ctx = data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, log, 0, "thread open handler");
+
+    ctx->rc = ngx_open_and_stat_file(&ctx->name, &ctx->of, log);
+
+    /* the descriptor of a cached file is not owned by the task */
+
+    ctx->opened = (ctx->of.fd != NGX_INVALID_FILE && ctx->of.fd != ctx->fd);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, log, 0,
+                   "thread open: %i, fd:%d (err: %d)",
+                   ctx->rc, ctx->of.fd, ctx->of.err);
+}
+
+
+static void
+ngx_thread_open_file_cleanup(void *data)
+{
+    ngx_thread_open_file_ctx_t *ctx = data;
+
+    /* the result of the task was not used */
+
+    if (ctx->opened) {
+        if (ngx_close_file(ctx->of.fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                          ngx_close_file_n " \"%V\" failed", &ctx->name);
+        }
+
+        ctx->opened = 0;
+    }
+}
+
+#endif
+
+
 /*
  * we ignore any possible event setting error and
  * fallback to usual periodic file retests
@@ -16,7 +16,9 @@
 #define NGX_OPEN_FILE_DIRECTIO_OFF  NGX_MAX_OFF_T_VALUE
 
 
-typedef struct {
+typedef struct ngx_open_file_info_s  ngx_open_file_info_t;
+
+struct ngx_open_file_info_s {
     ngx_fd_t                 fd;
     ngx_file_uniq_t          uniq;
     time_t                   mtime;
@@ -32,6 +34,13 @@ typedef struct {
 
     ngx_uint_t               min_uses;
 
+#if (NGX_THREADS)
+    ngx_int_t              (*thread_handler)(ngx_thread_task_t *task,
+                                             ngx_open_file_info_t *of);
+    void                    *thread_ctx;
+    ngx_thread_task_t       *thread_task;
+#endif
+
 #if (NGX_HAVE_OPENAT)
     size_t                   disable_symlinks_from;
     unsigned                 disable_symlinks:2;
@@ -48,7 +57,7 @@ typedef struct {
     unsigned                 is_link:1;
     unsigned                 is_exec:1;
     unsigned                 is_directio:1;
-} ngx_open_file_info_t;
+};
 
 
 typedef struct ngx_cached_open_file_s  ngx_cached_open_file_t;
@@ -9,8 +9,48 @@
 #include <ngx_core.h>
 
 
+#if (NGX_POOL_PROFILE)
+
+/* the profiling wrappers themselves call the functions defined here */
+
+#undef ngx_palloc
+#undef ngx_pnalloc
+#undef ngx_pcalloc
+
+static void ngx_pool_profile_account(ngx_pool_t *pool, size_t size,
+    char *file, ngx_uint_t line);
+
+#endif
+
+
+/*
+ * Pool blocks whose size is a multiple of the page size are not returned
+ * to malloc() when a pool is destroyed but are kept in per-process free
+ * lists, one per number of pages, until ngx_pool_cache_max bytes are kept.
+ * The lists are not locked: pools are only created and destroyed by the
+ * thread running the event loop.
+ */
+
+#define NGX_POOL_CACHE_SLOTS  16
+
+
+typedef struct ngx_pool_cached_block_s  ngx_pool_cached_block_t;
+
+struct ngx_pool_cached_block_s {
+    ngx_pool_cached_block_t  *next;
+};
+
+
 static void *ngx_palloc_block(ngx_pool_t *pool, size_t size);
 static void *ngx_palloc_large(ngx_pool_t *pool, size_t size);
+static void *ngx_pool_alloc_block(size_t size, ngx_log_t *log);
+static void ngx_pool_free_block(void *p, size_t size);
+
+
+static ngx_pool_cached_block_t  *ngx_pool_cache[NGX_POOL_CACHE_SLOTS + 1];
+static size_t                    ngx_pool_cache_max;
+
+ngx_pool_cache_stat_t            ngx_pool_cache_stat;
 
 
 ngx_pool_t *
@@ -18,7 +58,7 @@ ngx_create_pool(size_t size, ngx_log_t *log)
 {
     ngx_pool_t  *p;
 
-    p = ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+    p = ngx_pool_alloc_block(size, log);
     if (p == NULL) {
         return NULL;
     }
@@ -84,7 +124,7 @@ ngx_destroy_pool(ngx_pool_t *pool)
 #endif
 
     for (p = pool, n = pool->d.next; /* void */; p = n, n = n->d.next) {
-        ngx_free(p);
+        ngx_pool_free_block(p, p->d.end - (u_char *) p);
 
         if (n == NULL) {
             break;
@@ -185,7 +225,7 @@ ngx_palloc_block(ngx_pool_t *pool, size_t size)
 
     psize = (size_t) (pool->d.end - (u_char *) pool);
 
-    m = ngx_memalign(NGX_POOL_ALIGNMENT, psize, pool->log);
+    m = ngx_pool_alloc_block(psize, pool->log);
     if (m == NULL) {
         return NULL;
     }
@@ -403,30 +443,213 @@ ngx_pool_delete_file(void *data)
 }
 
 
-#if 0
+
+void
+ngx_pool_cache_init(size_t max)
+{
+    ngx_pool_cache_flush();
+
+    ngx_pool_cache_max = max;
+}
+
+
+void
+ngx_pool_cache_flush(void)
+{
+    ngx_uint_t                i;
+    ngx_pool_cached_block_t  *b;
+
+    for (i = 1; i <= NGX_POOL_CACHE_SLOTS; i++) {
+        while (ngx_pool_cache[i]) {
+            b = ngx_pool_cache[i];
+            ngx_pool_cache[i] = b->next;
+            ngx_free(b);
+        }
+    }
+
+    ngx_pool_cache_max = 0;
+    ngx_pool_cache_stat.size = 0;
+    ngx_pool_cache_stat.blocks = 0;
+}
+
 
 static void *
-ngx_get_cached_block(size_t size)
+ngx_pool_alloc_block(size_t size, ngx_log_t *log)
 {
-    void                     *p;
-    ngx_cached_block_slot_t  *slot;
+    ngx_uint_t                n;
+    ngx_pool_cached_block_t  *b;
 
-    if (ngx_cycle->cache == NULL) {
-        return NULL;
+    if (ngx_pool_cache_max && size % ngx_pagesize == 0) {
+
+        n = size / ngx_pagesize;
+
+        if (n <= NGX_POOL_CACHE_SLOTS) {
+            b = ngx_pool_cache[n];
+
+            if (b) {
+                ngx_pool_cache[n] = b->next;
+
+                ngx_pool_cache_stat.hits++;
+                ngx_pool_cache_stat.blocks--;
+                ngx_pool_cache_stat.size -= size;
+
+                return b;
+            }
+
+            ngx_pool_cache_stat.misses++;
+        }
     }
 
-    slot = &ngx_cycle->cache[(size + ngx_pagesize - 1) / ngx_pagesize];
+    return ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+}
+
+
+static void
+ngx_pool_free_block(void *p, size_t size)
+{
+    ngx_uint_t                n;
+    ngx_pool_cached_block_t  *b;
+
+    if (ngx_pool_cache_max
+        && size % ngx_pagesize == 0
+        && ngx_pool_cache_stat.size + size <= ngx_pool_cache_max)
+    {
+        n = size / ngx_pagesize;
+
+        if (n <= NGX_POOL_CACHE_SLOTS) {
+            b = p;
+            b->next = ngx_pool_cache[n];
+            ngx_pool_cache[n] = b;
+
+            ngx_pool_cache_stat.blocks++;
+            ngx_pool_cache_stat.size += size;
+
+            return;
+        }
+    }
+
+    ngx_free(p);
+}
 
-    slot->tries++;
 
-    if (slot->number) {
-        p = slot->block;
-        slot->block = slot->block->next;
-        slot->number--;
-        return p;
+#if (NGX_POOL_PROFILE)
+
+ngx_pool_profile_t  *ngx_pool_profile;
+
+
+void *
+ngx_palloc_profile(ngx_pool_t *pool, size_t size, char *file, ngx_uint_t line)
+{
+    ngx_pool_profile_account(pool, size, file, line);
+
+    return ngx_palloc(pool, size);
+}
+
+
+void *
+ngx_pnalloc_profile(ngx_pool_t *pool, size_t size, char *file,
+    ngx_uint_t line)
+{
+    ngx_pool_profile_account(pool, size, file, line);
+
+    return ngx_pnalloc(pool, size);
+}
+
+
+void *
+ngx_pcalloc_profile(ngx_pool_t *pool, size_t size, char *file,
+    ngx_uint_t line)
+{
+    ngx_pool_profile_account(pool, size, file, line);
+
+    return ngx_pcalloc(pool, size);
+}
+
+
+static void
+ngx_pool_profile_account(ngx_pool_t *pool, size_t size, char *file,
+    ngx_uint_t line)
+{
+    char                     *name;
+    size_t                    len;
+    ngx_uint_t                i, n, key;
+    ngx_pool_profile_t       *pp;
+    ngx_pool_profile_site_t  *site;
+
+    pp = ngx_pool_profile;
+
+    if (pp == NULL) {
+        return;
+    }
+
+    /* sites are identified by the address of __FILE__ and the line */
+
+    key = ((uintptr_t) file >> 3) ^ (line * 2654435761);
+
+    for (n = 0; n < pp->nsites; n++) {
+
+        i = (key + n) & (pp->nsites - 1);
+        site = &pp->sites[i];
+
+        /*
+         * an empty site is claimed without a lock, so a process that dies
+         * while filling in a site costs only the slot; a site being filled
+         * in by another process is skipped, and at worst a call site that
+         * races itself is accounted in two slots
+         */
+
+        if (site->line == 0) {
+
+            if (site->claimed) {
+                continue;
+            }
+
+            /* keep the open addressing table from filling up */
+
+            if (pp->used >= pp->nsites - pp->nsites / 4) {
+                break;
+            }
+
+            if (!ngx_atomic_cmp_set(&site->claimed, 0, 1)) {
+                continue;
+            }
+
+            (void) ngx_atomic_fetch_add(&pp->used, 1);
+
+            name = file;
+            len = ngx_strlen(name);
+
+            if (len >= NGX_POOL_PROFILE_NAME_LEN) {
+                name += len - (NGX_POOL_PROFILE_NAME_LEN - 1);
+                len = NGX_POOL_PROFILE_NAME_LEN - 1;
+            }
+
+            ngx_memcpy(site->name, name, len);
+            site->name[len] = '\0';
+
+            site->file = file;
+
+            ngx_memory_barrier();
+
+            site->line = line;
+        }
+
+        if (site->file != file || site->line != line) {
+            continue;
+        }
+
+        (void) ngx_atomic_fetch_add(&site->calls, 1);
+        (void) ngx_atomic_fetch_add(&site->bytes, size);
+
+        if (size > pool->max) {
+            (void) ngx_atomic_fetch_add(&site->large, 1);
+            (void) ngx_atomic_fetch_add(&site->large_bytes, size);
+        }
+
+        return;
     }
 
-    return NULL;
+    (void) ngx_atomic_fetch_add(&pp->dropped, 1);
 }
 
 #endif
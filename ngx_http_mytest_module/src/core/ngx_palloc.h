@@ -65,6 +65,41 @@ struct ngx_pool_s {
 };
 
 
+typedef struct {
+    ngx_uint_t            hits;
+    ngx_uint_t            misses;
+    ngx_uint_t            blocks;
+    size_t                size;
+} ngx_pool_cache_stat_t;
+
+
+#if (NGX_POOL_PROFILE)
+
+#define NGX_POOL_PROFILE_NAME_LEN  48
+
+typedef struct {
+    ngx_atomic_t          claimed;
+    char                 *file;
+    ngx_uint_t            line;
+    u_char                name[NGX_POOL_PROFILE_NAME_LEN];
+
+    ngx_atomic_t          calls;
+    ngx_atomic_t          bytes;
+    ngx_atomic_t          large;
+    ngx_atomic_t          large_bytes;
+} ngx_pool_profile_site_t;
+
+
+typedef struct {
+    ngx_uint_t                nsites;
+    ngx_atomic_t              used;
+    ngx_atomic_t              dropped;
+    ngx_pool_profile_site_t  *sites;
+} ngx_pool_profile_t;
+
+#endif
+
+
 typedef struct {
     ngx_fd_t              fd;
     u_char               *name;
@@ -91,5 +126,38 @@ void ngx_pool_run_cleanup_file(ngx_pool_t *p, ngx_fd_t fd);
 void ngx_pool_cleanup_file(void *data);
 void ngx_pool_delete_file(void *data);
 
+void ngx_pool_cache_init(size_t max);
+void ngx_pool_cache_flush(void);
+
+
+extern ngx_pool_cache_stat_t  ngx_pool_cache_stat;
+
+
+#if (NGX_POOL_PROFILE)
+
+/*
+ * the allocations are accounted to the file and line of the caller
+ * while ngx_pool_profile points to a table in shared memory
+ */
+
+void *ngx_palloc_profile(ngx_pool_t *pool, size_t size, char *file,
+    ngx_uint_t line);
+void *ngx_pnalloc_profile(ngx_pool_t *pool, size_t size, char *file,
+    ngx_uint_t line);
+void *ngx_pcalloc_profile(ngx_pool_t *pool, size_t size, char *file,
+    ngx_uint_t line);
+
+#define ngx_palloc(pool, size)                                                \
+    ngx_palloc_profile(pool, size, __FILE__, __LINE__)
+#define ngx_pnalloc(pool, size)                                               \
+    ngx_pnalloc_profile(pool, size, __FILE__, __LINE__)
+#define ngx_pcalloc(pool, size)                                               \
+    ngx_pcalloc_profile(pool, size, __FILE__, __LINE__)
+
+
+extern ngx_pool_profile_t  *ngx_pool_profile;
+
+#endif
+
 
 #endif /* _NGX_PALLOC_H_INCLUDED_ */
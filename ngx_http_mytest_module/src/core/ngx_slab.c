@@ -106,6 +106,15 @@ ngx_slab_init(ngx_slab_pool_t *pool)
 
     p += n * sizeof(ngx_slab_page_t);
 
+    /* the last entry counts allocations of whole pages */
+
+    pool->stats = (ngx_slab_stat_t *) p;
+    ngx_memzero(pool->stats, (n + 1) * sizeof(ngx_slab_stat_t));
+
+    p += (n + 1) * sizeof(ngx_slab_stat_t);
+
+    size -= n * sizeof(ngx_slab_page_t) + (n + 1) * sizeof(ngx_slab_stat_t);
+
     pages = (ngx_uint_t) (size / (ngx_pagesize + sizeof(ngx_slab_page_t)));
 
     ngx_memzero(p, pages * sizeof(ngx_slab_page_t));
@@ -130,6 +139,7 @@ ngx_slab_init(ngx_slab_pool_t *pool)
     }
 
     pool->last = pool->pages + pages;
+    pool->pfree = pages;
 
     pool->log_nomem = 1;
     pool->log_ctx = &pool->zero;
@@ -158,6 +168,7 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
     size_t            s;
     uintptr_t         p, n, m, mask, *bitmap;
     ngx_uint_t        i, slot, shift, map;
+    ngx_slab_stat_t  *stat;
     ngx_slab_page_t  *page, *prev, *slots;
 
     if (size > ngx_slab_max_size) {
@@ -165,14 +176,25 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
         ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
                        "slab alloc: %uz", size);
 
-        page = ngx_slab_alloc_pages(pool, (size >> ngx_pagesize_shift)
-                                          + ((size % ngx_pagesize) ? 1 : 0));
+        n = (size >> ngx_pagesize_shift) + ((size % ngx_pagesize) ? 1 : 0);
+        stat = &pool->stats[ngx_pagesize_shift - pool->min_shift];
+
+        stat->reqs++;
+
+        page = ngx_slab_alloc_pages(pool, n);
         if (page) {
             p = (page - pool->pages) << ngx_pagesize_shift;
             p += (uintptr_t) pool->start;
 
+            stat->used += n;
+
+            if (stat->used > stat->max) {
+                stat->max = stat->used;
+            }
+
         } else {
             p = 0;
+            stat->fails++;
         }
 
         goto done;
@@ -192,6 +214,9 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
     ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
                    "slab alloc: %uz slot: %ui", size, slot);
 
+    stat = &pool->stats[slot];
+    stat->reqs++;
+
     slots = (ngx_slab_page_t *) ((u_char *) pool + sizeof(ngx_slab_pool_t));
     page = slots[slot].next;
 
@@ -225,7 +250,7 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
                                      if (bitmap[n] != NGX_SLAB_BUSY) {
                                          p = (uintptr_t) bitmap + i;
 
-                                         goto done;
+                                         goto chunk;
                                      }
                                 }
 
@@ -240,7 +265,7 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 
                             p = (uintptr_t) bitmap + i;
 
-                            goto done;
+                            goto chunk;
                         }
                     }
                 }
@@ -275,7 +300,7 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
                         p += i << shift;
                         p += (uintptr_t) pool->start;
 
-                        goto done;
+                        goto chunk;
                     }
                 }
 
@@ -317,7 +342,7 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
                         p += i << shift;
                         p += (uintptr_t) pool->start;
 
-                        goto done;
+                        goto chunk;
                     }
                 }
 
@@ -353,12 +378,14 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
             page->next = &slots[slot];
             page->prev = (uintptr_t) &slots[slot] | NGX_SLAB_SMALL;
 
+            stat->total += (ngx_pagesize >> shift) - n;
+
             slots[slot].next = page;
 
             p = ((page - pool->pages) << ngx_pagesize_shift) + s * n;
             p += (uintptr_t) pool->start;
 
-            goto done;
+            goto chunk;
 
         } else if (shift == ngx_slab_exact_shift) {
 
@@ -366,12 +393,14 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
             page->next = &slots[slot];
             page->prev = (uintptr_t) &slots[slot] | NGX_SLAB_EXACT;
 
+            stat->total += 8 * sizeof(uintptr_t);
+
             slots[slot].next = page;
 
             p = (page - pool->pages) << ngx_pagesize_shift;
             p += (uintptr_t) pool->start;
 
-            goto done;
+            goto chunk;
 
         } else { /* shift > ngx_slab_exact_shift */
 
@@ -379,16 +408,27 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
             page->next = &slots[slot];
             page->prev = (uintptr_t) &slots[slot] | NGX_SLAB_BIG;
 
+            stat->total += ngx_pagesize >> shift;
+
             slots[slot].next = page;
 
             p = (page - pool->pages) << ngx_pagesize_shift;
             p += (uintptr_t) pool->start;
 
-            goto done;
+            goto chunk;
         }
     }
 
     p = 0;
+    stat->fails++;
+
+    goto done;
+
+chunk:
+
+    if (++stat->used > stat->max) {
+        stat->max = stat->used;
+    }
 
 done:
 
@@ -464,6 +504,7 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
         shift = slab & NGX_SLAB_SHIFT_MASK;
         size = 1 << shift;
+        slot = shift - pool->min_shift;
 
         if ((uintptr_t) p & (size - 1)) {
             goto wrong_chunk;
@@ -480,7 +521,6 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
             if (page->next == NULL) {
                 slots = (ngx_slab_page_t *)
                                    ((u_char *) pool + sizeof(ngx_slab_pool_t));
-                slot = shift - pool->min_shift;
 
                 page->next = slots[slot].next;
                 slots[slot].next = page;
@@ -491,6 +531,8 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
             bitmap[n] &= ~m;
 
+            pool->stats[slot].used--;
+
             n = (1 << (ngx_pagesize_shift - shift)) / 8 / (1 << shift);
 
             if (n == 0) {
@@ -503,14 +545,16 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
             map = (1 << (ngx_pagesize_shift - shift)) / (sizeof(uintptr_t) * 8);
 
-            for (n = 1; n < map; n++) {
-                if (bitmap[n]) {
+            for (m = 1; m < map; m++) {
+                if (bitmap[m]) {
                     goto done;
                 }
             }
 
             ngx_slab_free_pages(pool, page, 1);
 
+            pool->stats[slot].total -= (ngx_pagesize >> shift) - n;
+
             goto done;
         }
 
@@ -521,6 +565,7 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
         m = (uintptr_t) 1 <<
                 (((uintptr_t) p & (ngx_pagesize - 1)) >> ngx_slab_exact_shift);
         size = ngx_slab_exact_size;
+        slot = ngx_slab_exact_shift - pool->min_shift;
 
         if ((uintptr_t) p & (size - 1)) {
             goto wrong_chunk;
@@ -530,7 +575,6 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
             if (slab == NGX_SLAB_BUSY) {
                 slots = (ngx_slab_page_t *)
                                    ((u_char *) pool + sizeof(ngx_slab_pool_t));
-                slot = ngx_slab_exact_shift - pool->min_shift;
 
                 page->next = slots[slot].next;
                 slots[slot].next = page;
@@ -541,12 +585,16 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
             page->slab &= ~m;
 
+            pool->stats[slot].used--;
+
             if (page->slab) {
                 goto done;
             }
 
             ngx_slab_free_pages(pool, page, 1);
 
+            pool->stats[slot].total -= 8 * sizeof(uintptr_t);
+
             goto done;
         }
 
@@ -556,6 +604,7 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
         shift = slab & NGX_SLAB_SHIFT_MASK;
         size = 1 << shift;
+        slot = shift - pool->min_shift;
 
         if ((uintptr_t) p & (size - 1)) {
             goto wrong_chunk;
@@ -569,7 +618,6 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
             if (page->next == NULL) {
                 slots = (ngx_slab_page_t *)
                                    ((u_char *) pool + sizeof(ngx_slab_pool_t));
-                slot = shift - pool->min_shift;
 
                 page->next = slots[slot].next;
                 slots[slot].next = page;
@@ -580,12 +628,16 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
             page->slab &= ~m;
 
+            pool->stats[slot].used--;
+
             if (page->slab & NGX_SLAB_MAP_MASK) {
                 goto done;
             }
 
             ngx_slab_free_pages(pool, page, 1);
 
+            pool->stats[slot].total -= ngx_pagesize >> shift;
+
             goto done;
         }
 
@@ -614,6 +666,8 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
         ngx_slab_free_pages(pool, &pool->pages[n], size);
 
+        pool->stats[ngx_pagesize_shift - pool->min_shift].used -= size;
+
         ngx_slab_junk(p, size << ngx_pagesize_shift);
 
         return;
@@ -677,6 +731,8 @@ ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages)
             page->next = NULL;
             page->prev = NGX_SLAB_PAGE;
 
+            pool->pfree -= pages;
+
             if (--pages == 0) {
                 return page;
             }
@@ -708,6 +764,8 @@ ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
     ngx_uint_t        type;
     ngx_slab_page_t  *prev, *join;
 
+    pool->pfree += pages;
+
     page->slab = pages--;
 
     if (pages) {
@@ -22,6 +22,16 @@ struct ngx_slab_page_s {
 };
 
 
+typedef struct {
+    ngx_uint_t        total;
+    ngx_uint_t        used;
+    ngx_uint_t        max;
+
+    ngx_uint_t        reqs;
+    ngx_uint_t        fails;
+} ngx_slab_stat_t;
+
+
 typedef struct {
     ngx_shmtx_sh_t    lock;
 
@@ -32,6 +42,9 @@ typedef struct {
     ngx_slab_page_t  *last;
     ngx_slab_page_t   free;
 
+    ngx_slab_stat_t  *stats;
+    ngx_uint_t        pfree;
+
     u_char           *start;
     u_char           *end;
 
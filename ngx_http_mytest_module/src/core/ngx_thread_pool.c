@@ -26,12 +26,42 @@ typedef struct {
     (q)->last = &(q)->first
 
 
-struct ngx_thread_pool_s {
+/*
+ * each thread has its own queue, tasks are posted to the queues in turn,
+ * and an idle thread takes the oldest task from the queues of the others
+ */
+
+typedef struct {
     ngx_thread_mutex_t        mtx;
     ngx_thread_pool_queue_t   queue;
-    ngx_int_t                 waiting;
     ngx_thread_cond_t         cond;
 
+    /* read without the mutex as a hint */
+    ngx_uint_t                sleeping;  /* unsigned  sleeping:1; */
+
+    ngx_thread_pool_t        *tp;
+    ngx_uint_t                n;
+
+    /* the statistics are updated by the thread itself only */
+
+    ngx_uint_t                tasks;
+    ngx_uint_t                steals;
+    ngx_uint_t                notifies;
+
+    uint64_t                  wait_time;
+    uint64_t                  exec_time;
+
+    ngx_uint_t                wait[NGX_THREAD_POOL_HIST];
+    ngx_uint_t                exec[NGX_THREAD_POOL_HIST];
+} ngx_thread_pool_thread_t;
+
+
+struct ngx_thread_pool_s {
+    ngx_thread_pool_thread_t *thread;
+    ngx_uint_t                next;
+    ngx_atomic_t              queued;
+    ngx_uint_t                overflows;
+
     ngx_log_t                *log;
 
     ngx_str_t                 name;
@@ -48,7 +78,15 @@ static ngx_int_t ngx_thread_pool_init(ngx_thread_pool_t *tp, ngx_log_t *log,
 static void ngx_thread_pool_destroy(ngx_thread_pool_t *tp);
 static void ngx_thread_pool_exit_handler(void *data, ngx_log_t *log);
 
+static void ngx_thread_pool_wakeup(ngx_thread_pool_t *tp,
+    ngx_thread_pool_thread_t *thr);
 static void *ngx_thread_pool_cycle(void *data);
+static ngx_thread_task_t *ngx_thread_pool_dequeue(
+    ngx_thread_pool_thread_t *thr, ngx_uint_t steal);
+static ngx_thread_task_t *ngx_thread_pool_steal(ngx_thread_pool_thread_t *thr);
+static void ngx_thread_pool_account(ngx_thread_pool_thread_t *thr,
+    ngx_thread_task_t *task, uint64_t start, uint64_t end);
+static uint64_t ngx_thread_pool_usec(void);
 static void ngx_thread_pool_handler(ngx_event_t *ev);
 
 static char *ngx_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
@@ -106,10 +144,11 @@ static ngx_thread_pool_queue_t  ngx_thread_pool_done;
 static ngx_int_t
 ngx_thread_pool_init(ngx_thread_pool_t *tp, ngx_log_t *log, ngx_pool_t *pool)
 {
-    int             err;
-    pthread_t       tid;
-    ngx_uint_t      n;
-    pthread_attr_t  attr;
+    int                        err;
+    pthread_t                  tid;
+    ngx_uint_t                 n;
+    pthread_attr_t             attr;
+    ngx_thread_pool_thread_t  *thr;
 
     if (ngx_notify == NULL) {
         ngx_log_error(NGX_LOG_ALERT, log, 0,
@@ -117,15 +156,28 @@ ngx_thread_pool_init(ngx_thread_pool_t *tp, ngx_log_t *log, ngx_pool_t *pool)
         return NGX_ERROR;
     }
 
-    ngx_thread_pool_queue_init(&tp->queue);
-
-    if (ngx_thread_mutex_create(&tp->mtx, log) != NGX_OK) {
+    tp->thread = ngx_pcalloc(pool,
+                             tp->threads * sizeof(ngx_thread_pool_thread_t));
+    if (tp->thread == NULL) {
         return NGX_ERROR;
     }
 
-    if (ngx_thread_cond_create(&tp->cond, log) != NGX_OK) {
-        (void) ngx_thread_mutex_destroy(&tp->mtx, log);
-        return NGX_ERROR;
+    for (n = 0; n < tp->threads; n++) {
+        thr = &tp->thread[n];
+
+        ngx_thread_pool_queue_init(&thr->queue);
+
+        if (ngx_thread_mutex_create(&thr->mtx, log) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (ngx_thread_cond_create(&thr->cond, log) != NGX_OK) {
+            (void) ngx_thread_mutex_destroy(&thr->mtx, log);
+            return NGX_ERROR;
+        }
+
+        thr->tp = tp;
+        thr->n = n;
     }
 
     tp->log = log;
@@ -147,7 +199,8 @@ ngx_thread_pool_init(ngx_thread_pool_t *tp, ngx_log_t *log, ngx_pool_t *pool)
 #endif
 
     for (n = 0; n < tp->threads; n++) {
-        err = pthread_create(&tid, &attr, ngx_thread_pool_cycle, tp);
+        err = pthread_create(&tid, &attr, ngx_thread_pool_cycle,
+                             &tp->thread[n]);
         if (err) {
             ngx_log_error(NGX_LOG_ALERT, log, err,
                           "pthread_create() failed");
@@ -164,32 +217,55 @@ ngx_thread_pool_init(ngx_thread_pool_t *tp, ngx_log_t *log, ngx_pool_t *pool)
 static void
 ngx_thread_pool_destroy(ngx_thread_pool_t *tp)
 {
-    ngx_uint_t           n;
-    ngx_thread_task_t    task;
-    volatile ngx_uint_t  lock;
+    ngx_uint_t                 n;
+    ngx_thread_task_t          task;
+    volatile ngx_uint_t        lock;
+    ngx_thread_pool_thread_t  *thr;
+
+    if (tp->thread == NULL) {
+        return;
+    }
 
     ngx_memzero(&task, sizeof(ngx_thread_task_t));
 
     task.handler = ngx_thread_pool_exit_handler;
     task.ctx = (void *) &lock;
 
+    /*
+     * the exit task is queued to each thread directly, it is neither
+     * counted in tp->queued nor stolen by other threads
+     */
+
     for (n = 0; n < tp->threads; n++) {
+        thr = &tp->thread[n];
+
         lock = 1;
+        task.next = NULL;
 
-        if (ngx_thread_task_post(tp, &task) != NGX_OK) {
+        if (ngx_thread_mutex_lock(&thr->mtx, tp->log) != NGX_OK) {
             return;
         }
 
+        if (thr->sleeping) {
+            thr->sleeping = 0;
+            (void) ngx_thread_cond_signal(&thr->cond, tp->log);
+        }
+
+        *thr->queue.last = &task;
+        thr->queue.last = &task.next;
+
+        (void) ngx_thread_mutex_unlock(&thr->mtx, tp->log);
+
         while (lock) {
             ngx_sched_yield();
         }
-
-        task.event.active = 0;
     }
 
-    (void) ngx_thread_cond_destroy(&tp->cond, tp->log);
+    for (n = 0; n < tp->threads; n++) {
+        (void) ngx_thread_cond_destroy(&tp->thread[n].cond, tp->log);
 
-    (void) ngx_thread_mutex_destroy(&tp->mtx, tp->log);
+        (void) ngx_thread_mutex_destroy(&tp->thread[n].mtx, tp->log);
+    }
 }
 
 
@@ -223,22 +299,21 @@ ngx_thread_task_alloc(ngx_pool_t *pool, size_t size)
 ngx_int_t
 ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task)
 {
+    ngx_uint_t                 sleeping;
+    ngx_thread_pool_thread_t  *thr;
+
     if (task->event.active) {
         ngx_log_error(NGX_LOG_ALERT, tp->log, 0,
                       "task #%ui already active", task->id);
         return NGX_ERROR;
     }
 
-    if (ngx_thread_mutex_lock(&tp->mtx, tp->log) != NGX_OK) {
-        return NGX_ERROR;
-    }
-
-    if (tp->waiting >= tp->max_queue) {
-        (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+    if ((ngx_int_t) tp->queued >= tp->max_queue) {
+        tp->overflows++;
 
         ngx_log_error(NGX_LOG_ERR, tp->log, 0,
                       "thread pool \"%V\" queue overflow: %i tasks waiting",
-                      &tp->name, tp->waiting);
+                      &tp->name, (ngx_int_t) tp->queued);
         return NGX_ERROR;
     }
 
@@ -246,42 +321,100 @@ ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task)
 
     task->id = ngx_thread_pool_task_id++;
     task->next = NULL;
+    task->posted = ngx_thread_pool_usec();
+
+    /* tasks are only posted by the event loop, so tp->next needs no lock */
+
+    thr = &tp->thread[tp->next++ % tp->threads];
 
-    if (ngx_thread_cond_signal(&tp->cond, tp->log) != NGX_OK) {
-        (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+    if (ngx_thread_mutex_lock(&thr->mtx, tp->log) != NGX_OK) {
         return NGX_ERROR;
     }
 
-    *tp->queue.last = task;
-    tp->queue.last = &task->next;
+    sleeping = thr->sleeping;
 
-    tp->waiting++;
+    if (sleeping) {
+        if (ngx_thread_cond_signal(&thr->cond, tp->log) != NGX_OK) {
+            (void) ngx_thread_mutex_unlock(&thr->mtx, tp->log);
+            return NGX_ERROR;
+        }
+
+        thr->sleeping = 0;
+    }
 
-    (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+    *thr->queue.last = task;
+    thr->queue.last = &task->next;
 
-    ngx_log_debug2(NGX_LOG_DEBUG_CORE, tp->log, 0,
-                   "task #%ui added to thread pool \"%V\"",
-                   task->id, &tp->name);
+    (void) ngx_atomic_fetch_add(&tp->queued, 1);
+
+    (void) ngx_thread_mutex_unlock(&thr->mtx, tp->log);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, tp->log, 0,
+                   "task #%ui added to thread #%ui in pool \"%V\"",
+                   task->id, thr->n, &tp->name);
+
+    if (!sleeping) {
+        /*
+         * the thread is busy, let an idle one steal the task;
+         * an idle thread rechecks tp->queued before it sleeps
+         */
+
+        ngx_thread_pool_wakeup(tp, thr);
+    }
 
     return NGX_OK;
 }
 
 
+static void
+ngx_thread_pool_wakeup(ngx_thread_pool_t *tp, ngx_thread_pool_thread_t *thr)
+{
+    ngx_uint_t                 i;
+    ngx_thread_pool_thread_t  *idle;
+
+    for (i = 1; i < tp->threads; i++) {
+        idle = &tp->thread[(thr->n + i) % tp->threads];
+
+        if (!idle->sleeping) {
+            continue;
+        }
+
+        if (ngx_thread_mutex_lock(&idle->mtx, tp->log) != NGX_OK) {
+            return;
+        }
+
+        if (idle->sleeping) {
+            idle->sleeping = 0;
+            (void) ngx_thread_cond_signal(&idle->cond, tp->log);
+            (void) ngx_thread_mutex_unlock(&idle->mtx, tp->log);
+            return;
+        }
+
+        (void) ngx_thread_mutex_unlock(&idle->mtx, tp->log);
+    }
+}
+
+
 static void *
 ngx_thread_pool_cycle(void *data)
 {
-    ngx_thread_pool_t *tp = data;
+    ngx_thread_pool_thread_t *thr = data;
 
     int                 err;
+    uint64_t            start, end;
     sigset_t            set;
+    ngx_uint_t          empty;
+    ngx_thread_pool_t  *tp;
     ngx_thread_task_t  *task;
 
+    tp = thr->tp;
+
 #if 0
     ngx_time_update();
 #endif
 
-    ngx_log_debug1(NGX_LOG_DEBUG_CORE, tp->log, 0,
-                   "thread in pool \"%V\" started", &tp->name);
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, tp->log, 0,
+                   "thread #%ui in pool \"%V\" started", thr->n, &tp->name);
 
     sigfillset(&set);
 
@@ -297,58 +430,186 @@ ngx_thread_pool_cycle(void *data)
     }
 
     for ( ;; ) {
-        if (ngx_thread_mutex_lock(&tp->mtx, tp->log) != NGX_OK) {
-            return NULL;
-        }
+        task = ngx_thread_pool_dequeue(thr, 0);
 
-        /* the number may become negative */
-        tp->waiting--;
+        if (task == NULL) {
+            task = ngx_thread_pool_steal(thr);
+        }
 
-        while (tp->queue.first == NULL) {
-            if (ngx_thread_cond_wait(&tp->cond, &tp->mtx, tp->log)
-                != NGX_OK)
-            {
-                (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+        if (task == NULL) {
+            if (ngx_thread_mutex_lock(&thr->mtx, tp->log) != NGX_OK) {
                 return NULL;
             }
-        }
 
-        task = tp->queue.first;
-        tp->queue.first = task->next;
+            if (thr->queue.first == NULL) {
+                thr->sleeping = 1;
+
+                /* the atomic operation orders the flag and the counter */
+
+                if (ngx_atomic_fetch_add(&tp->queued, 0) == 0
+                    && ngx_thread_cond_wait(&thr->cond, &thr->mtx, tp->log)
+                       != NGX_OK)
+                {
+                    (void) ngx_thread_mutex_unlock(&thr->mtx, tp->log);
+                    return NULL;
+                }
+
+                thr->sleeping = 0;
+            }
+
+            if (ngx_thread_mutex_unlock(&thr->mtx, tp->log) != NGX_OK) {
+                return NULL;
+            }
 
-        if (tp->queue.first == NULL) {
-            tp->queue.last = &tp->queue.first;
+            continue;
         }
 
-        if (ngx_thread_mutex_unlock(&tp->mtx, tp->log) != NGX_OK) {
-            return NULL;
+        if (task->handler != ngx_thread_pool_exit_handler) {
+            (void) ngx_atomic_fetch_add(&tp->queued, -1);
         }
 
 #if 0
         ngx_time_update();
 #endif
 
-        ngx_log_debug2(NGX_LOG_DEBUG_CORE, tp->log, 0,
-                       "run task #%ui in thread pool \"%V\"",
-                       task->id, &tp->name);
+        ngx_log_debug3(NGX_LOG_DEBUG_CORE, tp->log, 0,
+                       "run task #%ui in thread #%ui in pool \"%V\"",
+                       task->id, thr->n, &tp->name);
+
+        start = ngx_thread_pool_usec();
 
         task->handler(task->ctx, tp->log);
 
-        ngx_log_debug2(NGX_LOG_DEBUG_CORE, tp->log, 0,
-                       "complete task #%ui in thread pool \"%V\"",
-                       task->id, &tp->name);
+        end = ngx_thread_pool_usec();
+
+        ngx_log_debug3(NGX_LOG_DEBUG_CORE, tp->log, 0,
+                       "complete task #%ui in thread #%ui in pool \"%V\"",
+                       task->id, thr->n, &tp->name);
+
+        ngx_thread_pool_account(thr, task, start, end);
 
         task->next = NULL;
 
         ngx_spinlock(&ngx_thread_pool_done_lock, 1, 2048);
 
+        empty = (ngx_thread_pool_done.first == NULL);
+
         *ngx_thread_pool_done.last = task;
         ngx_thread_pool_done.last = &task->next;
 
         ngx_unlock(&ngx_thread_pool_done_lock);
 
-        (void) ngx_notify(ngx_thread_pool_handler);
+        /*
+         * the task may be already freed here; completions are batched:
+         * a non-empty queue means that a notification is pending
+         */
+
+        if (empty) {
+            thr->notifies++;
+            (void) ngx_notify(ngx_thread_pool_handler);
+        }
+    }
+}
+
+
+static ngx_thread_task_t *
+ngx_thread_pool_dequeue(ngx_thread_pool_thread_t *thr, ngx_uint_t steal)
+{
+    ngx_thread_task_t  *task;
+
+    if (thr->queue.first == NULL) {
+        return NULL;
+    }
+
+    if (ngx_thread_mutex_lock(&thr->mtx, thr->tp->log) != NGX_OK) {
+        return NULL;
+    }
+
+    task = thr->queue.first;
+
+    /* each thread has to exit by itself */
+
+    if (task && steal && task->handler == ngx_thread_pool_exit_handler) {
+        task = NULL;
+    }
+
+    if (task) {
+        thr->queue.first = task->next;
+
+        if (thr->queue.first == NULL) {
+            thr->queue.last = &thr->queue.first;
+        }
+    }
+
+    (void) ngx_thread_mutex_unlock(&thr->mtx, thr->tp->log);
+
+    return task;
+}
+
+
+static ngx_thread_task_t *
+ngx_thread_pool_steal(ngx_thread_pool_thread_t *thr)
+{
+    ngx_uint_t                 i;
+    ngx_thread_pool_t         *tp;
+    ngx_thread_task_t         *task;
+    ngx_thread_pool_thread_t  *victim;
+
+    tp = thr->tp;
+
+    for (i = 1; i < tp->threads; i++) {
+        victim = &tp->thread[(thr->n + i) % tp->threads];
+
+        task = ngx_thread_pool_dequeue(victim, 1);
+
+        if (task) {
+            thr->steals++;
+            return task;
+        }
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_thread_pool_account(ngx_thread_pool_thread_t *thr, ngx_thread_task_t *task,
+    uint64_t start, uint64_t end)
+{
+    uint64_t    wait, exec;
+    ngx_uint_t  n;
+
+    /* the clock may step back */
+
+    wait = (start > task->posted) ? start - task->posted : 0;
+    exec = (end > start) ? end - start : 0;
+
+    thr->tasks++;
+    thr->wait_time += wait;
+    thr->exec_time += exec;
+
+    for (n = 0; wait > 1 && n < NGX_THREAD_POOL_HIST - 1; n++) {
+        wait >>= 1;
     }
+
+    thr->wait[n]++;
+
+    for (n = 0; exec > 1 && n < NGX_THREAD_POOL_HIST - 1; n++) {
+        exec >>= 1;
+    }
+
+    thr->exec[n]++;
+}
+
+
+static uint64_t
+ngx_thread_pool_usec(void)
+{
+    struct timeval  tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
 }
 
 
@@ -568,6 +829,58 @@ ngx_thread_pool_get(ngx_cycle_t *cycle, ngx_str_t *name)
 }
 
 
+ngx_int_t
+ngx_thread_pool_stat(ngx_cycle_t *cycle, ngx_uint_t n,
+    ngx_thread_pool_stat_t *st)
+{
+    ngx_uint_t                 i, k;
+    ngx_thread_pool_t        **tpp, *tp;
+    ngx_thread_pool_conf_t    *tcf;
+    ngx_thread_pool_thread_t  *thr;
+
+    tcf = (ngx_thread_pool_conf_t *) ngx_get_conf(cycle->conf_ctx,
+                                                  ngx_thread_pool_module);
+
+    if (tcf == NULL || n >= tcf->pools.nelts) {
+        return NGX_DECLINED;
+    }
+
+    tpp = tcf->pools.elts;
+    tp = tpp[n];
+
+    ngx_memzero(st, sizeof(ngx_thread_pool_stat_t));
+
+    st->name = tp->name;
+    st->threads = tp->threads;
+    st->max_queue = tp->max_queue;
+    st->queued = tp->queued;
+    st->overflows = tp->overflows;
+
+    if (tp->thread == NULL) {
+        return NGX_OK;
+    }
+
+    /* the counters are read while the threads update them */
+
+    for (i = 0; i < tp->threads; i++) {
+        thr = &tp->thread[i];
+
+        st->tasks += thr->tasks;
+        st->steals += thr->steals;
+        st->notifies += thr->notifies;
+        st->wait_time += thr->wait_time;
+        st->exec_time += thr->exec_time;
+
+        for (k = 0; k < NGX_THREAD_POOL_HIST; k++) {
+            st->wait[k] += thr->wait[k];
+            st->exec[k] += thr->exec[k];
+        }
+    }
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_thread_pool_init_worker(ngx_cycle_t *cycle)
 {
@@ -20,17 +20,45 @@ struct ngx_thread_task_s {
     void                *ctx;
     void               (*handler)(void *data, ngx_log_t *log);
     ngx_event_t          event;
+    uint64_t             posted;
 };
 
 
 typedef struct ngx_thread_pool_s  ngx_thread_pool_t;
 
 
+/* log2 buckets of microseconds */
+#define NGX_THREAD_POOL_HIST  24
+
+
+typedef struct {
+    ngx_str_t            name;
+    ngx_uint_t           threads;
+    ngx_int_t            max_queue;
+
+    ngx_uint_t           queued;
+    ngx_uint_t           overflows;
+
+    ngx_uint_t           tasks;
+    ngx_uint_t           steals;
+    ngx_uint_t           notifies;
+
+    uint64_t             wait_time;
+    uint64_t             exec_time;
+
+    ngx_uint_t           wait[NGX_THREAD_POOL_HIST];
+    ngx_uint_t           exec[NGX_THREAD_POOL_HIST];
+} ngx_thread_pool_stat_t;
+
+
 ngx_thread_pool_t *ngx_thread_pool_add(ngx_conf_t *cf, ngx_str_t *name);
 ngx_thread_pool_t *ngx_thread_pool_get(ngx_cycle_t *cycle, ngx_str_t *name);
 
 ngx_thread_task_t *ngx_thread_task_alloc(ngx_pool_t *pool, size_t size);
 ngx_int_t ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task);
 
+ngx_int_t ngx_thread_pool_stat(ngx_cycle_t *cycle, ngx_uint_t n,
+    ngx_thread_pool_stat_t *st);
+
 
 #endif /* _NGX_THREAD_POOL_H_INCLUDED_ */
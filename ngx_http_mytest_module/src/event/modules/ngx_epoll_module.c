@@ -97,9 +97,25 @@ struct io_event {
 typedef struct {
     ngx_uint_t  events;
     ngx_uint_t  aio_requests;
+    ngx_flag_t  batch;
+    ngx_flag_t  exclusive;
 } ngx_epoll_conf_t;
 
 
+/*
+ * a deferred change of the interest set of a connection, it is valid
+ * while c->read->index points to it and the descriptor is the same
+ */
+
+typedef struct {
+    ngx_connection_t  *connection;
+    ngx_socket_t       fd;
+    uint32_t           events;
+    ngx_uint_t         registered;
+    void              *data;
+} ngx_epoll_change_t;
+
+
 static ngx_int_t ngx_epoll_init(ngx_cycle_t *cycle, ngx_msec_t timer);
 #if (NGX_HAVE_EVENTFD)
 static ngx_int_t ngx_epoll_notify_init(ngx_log_t *log);
@@ -113,6 +129,10 @@ static ngx_int_t ngx_epoll_del_event(ngx_event_t *ev, ngx_int_t event,
 static ngx_int_t ngx_epoll_add_connection(ngx_connection_t *c);
 static ngx_int_t ngx_epoll_del_connection(ngx_connection_t *c,
     ngx_uint_t flags);
+static ngx_int_t ngx_epoll_change(ngx_connection_t *c, ngx_uint_t registered,
+    uint32_t events, void *data);
+static void ngx_epoll_cancel_change(ngx_connection_t *c);
+static void ngx_epoll_flush_changes(ngx_log_t *log);
 #if (NGX_HAVE_EVENTFD)
 static ngx_int_t ngx_epoll_notify(ngx_event_handler_pt handler);
 #endif
@@ -130,6 +150,10 @@ static int                  ep = -1;
 static struct epoll_event  *event_list;
 static ngx_uint_t           nevents;
 
+static ngx_epoll_change_t  *change_list;
+static ngx_uint_t           nchanges;
+static ngx_uint_t           max_changes;
+
 #if (NGX_HAVE_EVENTFD)
 static int                  notify_fd = -1;
 static ngx_event_t          notify_event;
@@ -164,6 +188,20 @@ static ngx_command_t  ngx_epoll_commands[] = {
       offsetof(ngx_epoll_conf_t, aio_requests),
       NULL },
 
+    { ngx_string("epoll_batch"),
+      NGX_EVENT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_epoll_conf_t, batch),
+      NULL },
+
+    { ngx_string("epoll_exclusive"),
+      NGX_EVENT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_epoll_conf_t, exclusive),
+      NULL },
+
       ngx_null_command
 };
 
@@ -354,6 +392,24 @@ ngx_epoll_init(ngx_cycle_t *cycle, ngx_msec_t timer)
 
     nevents = epcf->events;
 
+    if (change_list) {
+        ngx_free(change_list);
+        change_list = NULL;
+    }
+
+    nchanges = 0;
+    max_changes = 0;
+
+    if (epcf->batch) {
+        change_list = ngx_alloc(sizeof(ngx_epoll_change_t) * epcf->events,
+                                cycle->log);
+        if (change_list == NULL) {
+            return NGX_ERROR;
+        }
+
+        max_changes = epcf->events;
+    }
+
     ngx_io = ngx_os_io;
 
     ngx_event_actions = ngx_epoll_module_ctx.actions;
@@ -366,6 +422,22 @@ ngx_epoll_init(ngx_cycle_t *cycle, ngx_msec_t timer)
                       |NGX_USE_GREEDY_EVENT
                       |NGX_USE_EPOLL_EVENT;
 
+#if (NGX_HAVE_EPOLLEXCLUSIVE)
+
+    if (epcf->exclusive) {
+        ngx_event_flags |= NGX_USE_EXCLUSIVE_EVENT;
+    }
+
+#else
+
+    if (epcf->exclusive) {
+        ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                      "\"epoll_exclusive\" is not supported "
+                      "on this platform, ignored");
+    }
+
+#endif
+
     return NGX_OK;
 }
 
@@ -495,6 +567,14 @@ ngx_epoll_done(ngx_cycle_t *cycle)
 
     event_list = NULL;
     nevents = 0;
+
+    if (change_list) {
+        ngx_free(change_list);
+    }
+
+    change_list = NULL;
+    nchanges = 0;
+    max_changes = 0;
 }
 
 
@@ -534,6 +614,16 @@ ngx_epoll_add_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
         op = EPOLL_CTL_ADD;
     }
 
+#if (NGX_HAVE_EPOLLEXCLUSIVE && NGX_HAVE_EPOLLRDHUP)
+
+    /* EPOLLEXCLUSIVE may not be combined with EPOLLRDHUP */
+
+    if (flags & NGX_EXCLUSIVE_EVENT) {
+        events &= ~EPOLLRDHUP;
+    }
+
+#endif
+
     ee.events = events | (uint32_t) flags;
     ee.data.ptr = (void *) ((uintptr_t) c | ev->instance);
 
@@ -541,7 +631,14 @@ ngx_epoll_add_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
                    "epoll add event: fd:%d op:%d ev:%08XD",
                    c->fd, op, ee.events);
 
-    if (epoll_ctl(ep, op, c->fd, &ee) == -1) {
+    if (max_changes) {
+        if (ngx_epoll_change(c, op == EPOLL_CTL_MOD, ee.events, ee.data.ptr)
+            == NGX_ERROR)
+        {
+            return NGX_ERROR;
+        }
+
+    } else if (epoll_ctl(ep, op, c->fd, &ee) == -1) {
         ngx_log_error(NGX_LOG_ALERT, ev->log, ngx_errno,
                       "epoll_ctl(%d, %d) failed", op, c->fd);
         return NGX_ERROR;
@@ -573,6 +670,11 @@ ngx_epoll_del_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
 
     if (flags & NGX_CLOSE_EVENT) {
         ev->active = 0;
+
+        if (max_changes) {
+            ngx_epoll_cancel_change(ev->data);
+        }
+
         return NGX_OK;
     }
 
@@ -602,7 +704,12 @@ ngx_epoll_del_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
                    "epoll del event: fd:%d op:%d ev:%08XD",
                    c->fd, op, ee.events);
 
-    if (epoll_ctl(ep, op, c->fd, &ee) == -1) {
+    if (max_changes) {
+        if (ngx_epoll_change(c, 1, ee.events, ee.data.ptr) == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+    } else if (epoll_ctl(ep, op, c->fd, &ee) == -1) {
         ngx_log_error(NGX_LOG_ALERT, ev->log, ngx_errno,
                       "epoll_ctl(%d, %d) failed", op, c->fd);
         return NGX_ERROR;
@@ -625,7 +732,12 @@ ngx_epoll_add_connection(ngx_connection_t *c)
     ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
                    "epoll add connection: fd:%d ev:%08XD", c->fd, ee.events);
 
-    if (epoll_ctl(ep, EPOLL_CTL_ADD, c->fd, &ee) == -1) {
+    if (max_changes) {
+        if (ngx_epoll_change(c, 0, ee.events, ee.data.ptr) == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+    } else if (epoll_ctl(ep, EPOLL_CTL_ADD, c->fd, &ee) == -1) {
         ngx_log_error(NGX_LOG_ALERT, c->log, ngx_errno,
                       "epoll_ctl(EPOLL_CTL_ADD, %d) failed", c->fd);
         return NGX_ERROR;
@@ -653,6 +765,11 @@ ngx_epoll_del_connection(ngx_connection_t *c, ngx_uint_t flags)
     if (flags & NGX_CLOSE_EVENT) {
         c->read->active = 0;
         c->write->active = 0;
+
+        if (max_changes) {
+            ngx_epoll_cancel_change(c);
+        }
+
         return NGX_OK;
     }
 
@@ -663,7 +780,12 @@ ngx_epoll_del_connection(ngx_connection_t *c, ngx_uint_t flags)
     ee.events = 0;
     ee.data.ptr = NULL;
 
-    if (epoll_ctl(ep, op, c->fd, &ee) == -1) {
+    if (max_changes) {
+        if (ngx_epoll_change(c, 1, 0, NULL) == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+    } else if (epoll_ctl(ep, op, c->fd, &ee) == -1) {
         ngx_log_error(NGX_LOG_ALERT, c->log, ngx_errno,
                       "epoll_ctl(%d, %d) failed", op, c->fd);
         return NGX_ERROR;
@@ -676,6 +798,129 @@ ngx_epoll_del_connection(ngx_connection_t *c, ngx_uint_t flags)
 }
 
 
+static ngx_int_t
+ngx_epoll_change(ngx_connection_t *c, ngx_uint_t registered, uint32_t events,
+    void *data)
+{
+    struct epoll_event   ee;
+    ngx_epoll_change_t  *ch;
+
+    if (events == 0) {
+
+        /*
+         * a delete is not deferred: the caller may close the descriptor
+         * and free the connection right after it, while the file is still
+         * shared with other processes, e.g. a listening socket
+         */
+
+        if (c->read->index != NGX_INVALID_INDEX) {
+            ch = &change_list[c->read->index];
+
+            registered = ch->registered;
+
+            ch->connection = NULL;
+            c->read->index = NGX_INVALID_INDEX;
+        }
+
+        if (!registered) {
+            /* added and deleted within the iteration */
+            return NGX_OK;
+        }
+
+        ee.events = 0;
+        ee.data.ptr = NULL;
+
+        if (epoll_ctl(ep, EPOLL_CTL_DEL, c->fd, &ee) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, c->log, ngx_errno,
+                          "epoll_ctl(%d, %d) failed", EPOLL_CTL_DEL, c->fd);
+            return NGX_ERROR;
+        }
+
+        return NGX_OK;
+    }
+
+    /*
+     * the other changes of a connection made during an iteration are merged
+     * into one epoll_ctl() issued just before the next epoll_wait()
+     */
+
+    if (c->read->index != NGX_INVALID_INDEX) {
+        ch = &change_list[c->read->index];
+
+    } else {
+        if (nchanges == max_changes) {
+            ngx_epoll_flush_changes(c->log);
+        }
+
+        c->read->index = nchanges;
+
+        ch = &change_list[nchanges++];
+        ch->connection = c;
+        ch->fd = c->fd;
+        ch->registered = registered;
+    }
+
+    ch->events = events;
+    ch->data = data;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_epoll_cancel_change(ngx_connection_t *c)
+{
+    /* the descriptor is going to be closed, nothing to change */
+
+    if (c->read->index != NGX_INVALID_INDEX) {
+        change_list[c->read->index].connection = NULL;
+        c->read->index = NGX_INVALID_INDEX;
+    }
+}
+
+
+static void
+ngx_epoll_flush_changes(ngx_log_t *log)
+{
+    int                  op;
+    ngx_uint_t           i;
+    ngx_connection_t    *c;
+    struct epoll_event   ee;
+    ngx_epoll_change_t  *ch;
+
+    for (i = 0; i < nchanges; i++) {
+        ch = &change_list[i];
+        c = ch->connection;
+
+        /* the connection may have been closed and reused since then */
+
+        if (c == NULL || c->fd != ch->fd || c->read->index != i) {
+            continue;
+        }
+
+        c->read->index = NGX_INVALID_INDEX;
+
+        /* the deletes are done by ngx_epoll_change() at once */
+
+        op = ch->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+
+        ee.events = ch->events;
+        ee.data.ptr = ch->data;
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, log, 0,
+                       "epoll change: fd:%d op:%d ev:%08XD",
+                       c->fd, op, ee.events);
+
+        if (epoll_ctl(ep, op, c->fd, &ee) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, c->log, ngx_errno,
+                          "epoll_ctl(%d, %d) failed", op, c->fd);
+        }
+    }
+
+    nchanges = 0;
+}
+
+
 #if (NGX_HAVE_EVENTFD)
 
 static ngx_int_t
@@ -709,6 +954,10 @@ ngx_epoll_process_events(ngx_cycle_t *cycle, ngx_msec_t timer, ngx_uint_t flags)
     ngx_queue_t       *queue;
     ngx_connection_t  *c;
 
+    if (nchanges) {
+        ngx_epoll_flush_changes(cycle->log);
+    }
+
     /* NGX_TIMER_INFINITE == INFTIM */
 
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
@@ -952,6 +1201,8 @@ ngx_epoll_create_conf(ngx_cycle_t *cycle)
 
     epcf->events = NGX_CONF_UNSET;
     epcf->aio_requests = NGX_CONF_UNSET;
+    epcf->batch = NGX_CONF_UNSET;
+    epcf->exclusive = NGX_CONF_UNSET;
 
     return epcf;
 }
@@ -964,6 +1215,8 @@ ngx_epoll_init_conf(ngx_cycle_t *cycle, void *conf)
 
     ngx_conf_init_uint_value(epcf->events, 512);
     ngx_conf_init_uint_value(epcf->aio_requests, 32);
+    ngx_conf_init_value(epcf->batch, 0);
+    ngx_conf_init_value(epcf->exclusive, 0);
 
     return NGX_CONF_OK;
 }
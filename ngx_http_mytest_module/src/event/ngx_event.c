@@ -22,6 +22,11 @@ extern ngx_module_t ngx_select_module;
 
 static char *ngx_event_init_conf(ngx_cycle_t *cycle, void *conf);
 static ngx_int_t ngx_event_module_init(ngx_cycle_t *cycle);
+#if (NGX_STAT_ACCEPT)
+static ngx_int_t ngx_event_accept_stat_init(ngx_cycle_t *cycle,
+    ngx_core_conf_t *ccf);
+static void ngx_event_accept_stat_cleanup(void *data);
+#endif
 static ngx_int_t ngx_event_process_init(ngx_cycle_t *cycle);
 static char *ngx_events_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
@@ -55,6 +60,9 @@ ngx_uint_t            ngx_accept_events;
 ngx_uint_t            ngx_accept_mutex_held;
 ngx_msec_t            ngx_accept_mutex_delay;
 ngx_int_t             ngx_accept_disabled;
+#if (NGX_HAVE_EPOLLEXCLUSIVE)
+ngx_uint_t            ngx_use_exclusive_accept;
+#endif
 
 
 #if (NGX_STAT_STUB)
@@ -140,6 +148,13 @@ static ngx_command_t  ngx_event_core_commands[] = {
       offsetof(ngx_event_conf_t, multi_accept),
       NULL },
 
+    { ngx_string("accept_batch"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_event_conf_t, accept_batch),
+      NULL },
+
     { ngx_string("accept_mutex"),
       NGX_EVENT_CONF|NGX_CONF_FLAG,
       ngx_conf_set_flag_slot,
@@ -237,6 +252,16 @@ ngx_process_events_and_timers(ngx_cycle_t *cycle)
         }
     }
 
+#if (NGX_HAVE_EPOLLEXCLUSIVE)
+
+    if (ngx_use_exclusive_accept) {
+        if (ngx_balance_accept_events(cycle) == NGX_ERROR) {
+            return;
+        }
+    }
+
+#endif
+
     delta = ngx_current_msec;
 
     (void) ngx_process_events(cycle, timer, flags);
@@ -469,6 +494,11 @@ ngx_event_module_init(ngx_cycle_t *cycle)
     }
 #endif /* !(NGX_WIN32) */
 
+#if (NGX_STAT_ACCEPT)
+    if (ngx_event_accept_stat_init(cycle, ccf) != NGX_OK) {
+        return NGX_ERROR;
+    }
+#endif
 
     if (ccf->master == 0) {
         return NGX_OK;
@@ -550,6 +580,79 @@ ngx_event_module_init(ngx_cycle_t *cycle)
 }
 
 
+#if (NGX_STAT_ACCEPT)
+
+static ngx_int_t
+ngx_event_accept_stat_init(ngx_cycle_t *cycle, ngx_core_conf_t *ccf)
+{
+    u_char              *p;
+    size_t               size;
+    ngx_shm_t           *shm;
+    ngx_uint_t           i;
+    ngx_listening_t     *ls;
+    ngx_pool_cleanup_t  *cln;
+
+    /*
+     * the counters are allocated anew for each cycle as the listening
+     * sockets may change; they are freed along with the cycle, that is,
+     * once the new cycle has replaced it, or if the new cycle fails
+     */
+
+    if (cycle->listening.nelts == 0) {
+        return NGX_OK;
+    }
+
+    size = cycle->listening.nelts * sizeof(ngx_listening_stat_t);
+
+    if (ccf->master) {
+        cln = ngx_pool_cleanup_add(cycle->pool, sizeof(ngx_shm_t));
+        if (cln == NULL) {
+            return NGX_ERROR;
+        }
+
+        shm = cln->data;
+
+        shm->size = size;
+        shm->name.len = sizeof("nginx_accept_stat") - 1;
+        shm->name.data = (u_char *) "nginx_accept_stat";
+        shm->log = cycle->log;
+
+        if (ngx_shm_alloc(shm) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        cln->handler = ngx_event_accept_stat_cleanup;
+
+        p = shm->addr;
+
+    } else {
+        p = ngx_pcalloc(cycle->pool, size);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    ls = cycle->listening.elts;
+
+    for (i = 0; i < cycle->listening.nelts; i++) {
+        ls[i].stat = (ngx_listening_stat_t *) p + i;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_event_accept_stat_cleanup(void *data)
+{
+    ngx_shm_t  *shm = data;
+
+    ngx_shm_free(shm);
+}
+
+#endif
+
+
 #if !(NGX_WIN32)
 
 static void
@@ -625,6 +728,26 @@ ngx_event_process_init(ngx_cycle_t *cycle)
         break;
     }
 
+#if (NGX_HAVE_EPOLLEXCLUSIVE)
+
+    /*
+     * the kernel wakes up one worker for a new connection instead of
+     * the accept mutex; a busy worker stops waiting on the listening
+     * sockets until ngx_accept_disabled runs out
+     */
+
+    if ((ngx_event_flags & NGX_USE_EXCLUSIVE_EVENT)
+        && ccf->master && ccf->worker_processes > 1)
+    {
+        ngx_use_exclusive_accept = 1;
+        ngx_use_accept_mutex = 0;
+
+    } else {
+        ngx_use_exclusive_accept = 0;
+    }
+
+#endif
+
 #if !(NGX_WIN32)
 
     if (ngx_timer_resolution && !(ngx_event_flags & NGX_USE_TIMER_EVENT)) {
@@ -740,6 +863,22 @@ ngx_event_process_init(ngx_cycle_t *cycle)
         }
 #endif
 
+#if (NGX_HAVE_REUSEPORT_CBPF)
+
+        /*
+         * the first worker attaches the program once the workers are bound
+         * to their CPUs; without a master process only the first socket
+         * of a group is polled, so no program is attached
+         */
+
+        if (ls[i].incoming_cpu
+            && ngx_worker == 0
+            && ngx_process == NGX_PROCESS_WORKER)
+        {
+            (void) ngx_steer_listening(cycle, &ls[i]);
+        }
+#endif
+
         c = ngx_get_connection(ls[i].fd, cycle->log);
 
         if (c == NULL) {
@@ -829,6 +968,25 @@ ngx_event_process_init(ngx_cycle_t *cycle)
             continue;
         }
 
+#if (NGX_HAVE_EPOLLEXCLUSIVE)
+
+        if (ngx_use_exclusive_accept
+#if (NGX_HAVE_REUSEPORT)
+            && !ls[i].reuseport
+#endif
+           )
+        {
+            if (ngx_add_event(rev, NGX_READ_EVENT, NGX_EXCLUSIVE_EVENT)
+                == NGX_ERROR)
+            {
+                return NGX_ERROR;
+            }
+
+            continue;
+        }
+
+#endif
+
         if (ngx_add_event(rev, NGX_READ_EVENT, 0) == NGX_ERROR) {
             return NGX_ERROR;
         }
@@ -1161,6 +1319,7 @@ ngx_event_core_create_conf(ngx_cycle_t *cycle)
     ecf->use = NGX_CONF_UNSET_UINT;
     ecf->multi_accept = NGX_CONF_UNSET;
     ecf->accept_mutex = NGX_CONF_UNSET;
+    ecf->accept_batch = NGX_CONF_UNSET;
     ecf->accept_mutex_delay = NGX_CONF_UNSET_MSEC;
     ecf->name = (void *) NGX_CONF_UNSET;
 
@@ -1260,6 +1419,7 @@ ngx_event_core_init_conf(ngx_cycle_t *cycle, void *conf)
 
     ngx_conf_init_value(ecf->multi_accept, 0);
     ngx_conf_init_value(ecf->accept_mutex, 1);
+    ngx_conf_init_value(ecf->accept_batch, 0);
     ngx_conf_init_msec_value(ecf->accept_mutex_delay, 500);
 
     return NGX_CONF_OK;
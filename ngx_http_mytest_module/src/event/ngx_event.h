@@ -121,6 +121,11 @@ struct ngx_event_s {
 
     ngx_rbtree_node_t   timer;
 
+#if (NGX_TIMER_WHEEL)
+    /* the timing wheel slot, the timer.key is still the expiry time */
+    ngx_queue_t      timer_link;
+#endif
+
     /* the posted queue */
     ngx_queue_t      queue;
 
@@ -276,6 +281,12 @@ extern ngx_event_actions_t   ngx_event_actions;
  */
 #define NGX_USE_VNODE_EVENT      0x00002000
 
+/*
+ * The event filter wakes up only one of the processes waiting on
+ * a listening socket: epoll with EPOLLEXCLUSIVE.
+ */
+#define NGX_USE_EXCLUSIVE_EVENT  0x00004000
+
 
 /*
  * The event filter is deleted just before the closing file.
@@ -360,6 +371,9 @@ extern ngx_event_actions_t   ngx_event_actions;
 #define NGX_LEVEL_EVENT    0
 #define NGX_CLEAR_EVENT    EPOLLET
 #define NGX_ONESHOT_EVENT  0x70000000
+#if (NGX_HAVE_EPOLLEXCLUSIVE)
+#define NGX_EXCLUSIVE_EVENT  EPOLLEXCLUSIVE
+#endif
 #if 0
 #define NGX_ONESHOT_EVENT  EPOLLONESHOT
 #endif
@@ -430,6 +444,7 @@ typedef struct {
 
     ngx_flag_t    multi_accept;
     ngx_flag_t    accept_mutex;
+    ngx_int_t     accept_batch;
 
     ngx_msec_t    accept_mutex_delay;
 
@@ -460,6 +475,9 @@ extern ngx_uint_t             ngx_accept_events;
 extern ngx_uint_t             ngx_accept_mutex_held;
 extern ngx_msec_t             ngx_accept_mutex_delay;
 extern ngx_int_t              ngx_accept_disabled;
+#if (NGX_HAVE_EPOLLEXCLUSIVE)
+extern ngx_uint_t             ngx_use_exclusive_accept;
+#endif
 
 
 #if (NGX_STAT_STUB)
@@ -492,6 +510,9 @@ extern ngx_module_t           ngx_event_core_module;
 
 void ngx_event_accept(ngx_event_t *ev);
 ngx_int_t ngx_trylock_accept_mutex(ngx_cycle_t *cycle);
+#if (NGX_HAVE_EPOLLEXCLUSIVE)
+ngx_int_t ngx_balance_accept_events(ngx_cycle_t *cycle);
+#endif
 u_char *ngx_accept_log_error(ngx_log_t *log, u_char *buf, size_t len);
 
 
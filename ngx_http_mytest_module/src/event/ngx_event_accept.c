@@ -13,6 +13,10 @@
 static ngx_int_t ngx_enable_accept_events(ngx_cycle_t *cycle);
 static ngx_int_t ngx_disable_accept_events(ngx_cycle_t *cycle, ngx_uint_t all);
 static void ngx_close_accepted_connection(ngx_connection_t *c);
+#if (NGX_STAT_ACCEPT)
+static void ngx_event_accept_stat(ngx_connection_t *lc, ngx_uint_t n,
+    ngx_uint_t limited);
+#endif
 
 
 void
@@ -21,7 +25,7 @@ ngx_event_accept(ngx_event_t *ev)
     socklen_t          socklen;
     ngx_err_t          err;
     ngx_log_t         *log;
-    ngx_uint_t         level;
+    ngx_uint_t         level, n, batch, limited;
     ngx_socket_t       s;
     ngx_event_t       *rev, *wev;
     ngx_listening_t   *ls;
@@ -43,9 +47,21 @@ ngx_event_accept(ngx_event_t *ev)
     ecf = ngx_event_get_conf(ngx_cycle->conf_ctx, ngx_event_core_module);
 
     if (!(ngx_event_flags & NGX_USE_KQUEUE_EVENT)) {
-        ev->available = ecf->multi_accept;
+        ev->available = ecf->multi_accept || ecf->accept_batch;
     }
 
+    /*
+     * with accept_batch the loop stops after that many connections: the
+     * rest of the accept queue waits for the next iteration of the event
+     * loop, after the posted events of the established connections; the
+     * listening sockets are level-triggered and are reported again;
+     * errors break out of the loop as well to have the iteration counted
+     */
+
+    batch = ecf->accept_batch;
+    limited = 0;
+    n = 0;
+
     lc = ev->data;
     ls = lc->listening;
     ev->ready = 0;
@@ -73,7 +89,7 @@ ngx_event_accept(ngx_event_t *ev)
             if (err == NGX_EAGAIN) {
                 ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, err,
                                "accept() not ready");
-                return;
+                break;
             }
 
             level = NGX_LOG_ALERT;
@@ -112,7 +128,7 @@ ngx_event_accept(ngx_event_t *ev)
                 if (ngx_disable_accept_events((ngx_cycle_t *) ngx_cycle, 1)
                     != NGX_OK)
                 {
-                    return;
+                    break;
                 }
 
                 if (ngx_use_accept_mutex) {
@@ -128,13 +144,19 @@ ngx_event_accept(ngx_event_t *ev)
                 }
             }
 
-            return;
+            break;
         }
 
+        n++;
+
 #if (NGX_STAT_STUB)
         (void) ngx_atomic_fetch_add(ngx_stat_accepted, 1);
 #endif
 
+#if (NGX_STAT_ACCEPT)
+        (void) ngx_atomic_fetch_add(&ls->stat->accepted, 1);
+#endif
+
         ngx_accept_disabled = ngx_cycle->connection_n / 8
                               - ngx_cycle->free_connection_n;
 
@@ -146,7 +168,7 @@ ngx_event_accept(ngx_event_t *ev)
                               ngx_close_socket_n " failed");
             }
 
-            return;
+            break;
         }
 
 #if (NGX_STAT_STUB)
@@ -156,13 +178,13 @@ ngx_event_accept(ngx_event_t *ev)
         c->pool = ngx_create_pool(ls->pool_size, ev->log);
         if (c->pool == NULL) {
             ngx_close_accepted_connection(c);
-            return;
+            break;
         }
 
         c->sockaddr = ngx_palloc(c->pool, socklen);
         if (c->sockaddr == NULL) {
             ngx_close_accepted_connection(c);
-            return;
+            break;
         }
 
         ngx_memcpy(c->sockaddr, sa, socklen);
@@ -170,7 +192,7 @@ ngx_event_accept(ngx_event_t *ev)
         log = ngx_palloc(c->pool, sizeof(ngx_log_t));
         if (log == NULL) {
             ngx_close_accepted_connection(c);
-            return;
+            break;
         }
 
         /* set a blocking mode for iocp and non-blocking mode for others */
@@ -181,7 +203,7 @@ ngx_event_accept(ngx_event_t *ev)
                     ngx_log_error(NGX_LOG_ALERT, ev->log, ngx_socket_errno,
                                   ngx_blocking_n " failed");
                     ngx_close_accepted_connection(c);
-                    return;
+                    break;
                 }
             }
 
@@ -191,7 +213,7 @@ ngx_event_accept(ngx_event_t *ev)
                     ngx_log_error(NGX_LOG_ALERT, ev->log, ngx_socket_errno,
                                   ngx_nonblocking_n " failed");
                     ngx_close_accepted_connection(c);
-                    return;
+                    break;
                 }
             }
         }
@@ -262,7 +284,7 @@ ngx_event_accept(ngx_event_t *ev)
             c->addr_text.data = ngx_pnalloc(c->pool, ls->addr_text_max_len);
             if (c->addr_text.data == NULL) {
                 ngx_close_accepted_connection(c);
-                return;
+                break;
             }
 
             c->addr_text.len = ngx_sock_ntop(c->sockaddr, c->socklen,
@@ -270,7 +292,7 @@ ngx_event_accept(ngx_event_t *ev)
                                              ls->addr_text_max_len, 0);
             if (c->addr_text.len == 0) {
                 ngx_close_accepted_connection(c);
-                return;
+                break;
             }
         }
 
@@ -346,7 +368,7 @@ ngx_event_accept(ngx_event_t *ev)
         if (ngx_add_conn && (ngx_event_flags & NGX_USE_EPOLL_EVENT) == 0) {
             if (ngx_add_conn(c) == NGX_ERROR) {
                 ngx_close_accepted_connection(c);
-                return;
+                break;
             }
         }
 
@@ -359,7 +381,18 @@ ngx_event_accept(ngx_event_t *ev)
             ev->available--;
         }
 
+        if (n == batch) {
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                           "accept batch of %ui reached", n);
+            limited = 1;
+            break;
+        }
+
     } while (ev->available);
+
+#if (NGX_STAT_ACCEPT)
+    ngx_event_accept_stat(lc, n, limited);
+#endif
 }
 
 
@@ -401,10 +434,55 @@ ngx_trylock_accept_mutex(ngx_cycle_t *cycle)
 }
 
 
+#if (NGX_HAVE_EPOLLEXCLUSIVE)
+
+ngx_int_t
+ngx_balance_accept_events(ngx_cycle_t *cycle)
+{
+    static ngx_uint_t  disabled;
+
+    if (ngx_accept_disabled > 0) {
+        ngx_accept_disabled--;
+
+        if (disabled) {
+            return NGX_OK;
+        }
+
+        /* let the other workers take the new connections for a while */
+
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "exclusive accept disabled: %i", ngx_accept_disabled);
+
+        if (ngx_disable_accept_events(cycle, 0) == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        disabled = 1;
+
+        return NGX_OK;
+    }
+
+    if (disabled) {
+        ngx_log_debug0(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "exclusive accept enabled");
+
+        if (ngx_enable_accept_events(cycle) == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        disabled = 0;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_enable_accept_events(ngx_cycle_t *cycle)
 {
-    ngx_uint_t         i;
+    ngx_uint_t         i, flags;
     ngx_listening_t   *ls;
     ngx_connection_t  *c;
 
@@ -417,7 +495,22 @@ ngx_enable_accept_events(ngx_cycle_t *cycle)
             continue;
         }
 
-        if (ngx_add_event(c->read, NGX_READ_EVENT, 0) == NGX_ERROR) {
+        flags = 0;
+
+#if (NGX_HAVE_EPOLLEXCLUSIVE)
+
+        if (ngx_use_exclusive_accept
+#if (NGX_HAVE_REUSEPORT)
+            && !ls[i].reuseport
+#endif
+           )
+        {
+            flags = NGX_EXCLUSIVE_EVENT;
+        }
+
+#endif
+
+        if (ngx_add_event(c->read, NGX_READ_EVENT, flags) == NGX_ERROR) {
             return NGX_ERROR;
         }
     }
@@ -491,6 +584,74 @@ ngx_close_accepted_connection(ngx_connection_t *c)
 }
 
 
+#if (NGX_STAT_ACCEPT)
+
+static void
+ngx_event_accept_stat(ngx_connection_t *lc, ngx_uint_t n, ngx_uint_t limited)
+{
+    ngx_atomic_uint_t      max;
+    ngx_listening_stat_t  *st;
+#if (NGX_LINUX && NGX_HAVE_TCP_INFO)
+    socklen_t              len;
+    struct tcp_info        ti;
+#endif
+
+    st = lc->listening->stat;
+
+    (void) ngx_atomic_fetch_add(&st->loops, 1);
+
+    if (n == 0) {
+        (void) ngx_atomic_fetch_add(&st->empty, 1);
+        return;
+    }
+
+    do {
+        max = st->max_batch;
+
+        if (n <= max) {
+            break;
+        }
+
+    } while (!ngx_atomic_cmp_set(&st->max_batch, max, n));
+
+    if (!limited) {
+        return;
+    }
+
+    (void) ngx_atomic_fetch_add(&st->limited, 1);
+
+#if (NGX_LINUX && NGX_HAVE_TCP_INFO)
+
+    /*
+     * for a listening socket tcpi_unacked is the length of the accept
+     * queue and tcpi_sacked is its limit, the backlog
+     */
+
+    len = sizeof(struct tcp_info);
+
+    if (getsockopt(lc->fd, IPPROTO_TCP, TCP_INFO, &ti, &len) == -1) {
+        return;
+    }
+
+    do {
+        max = st->max_queue;
+
+        if (ti.tcpi_unacked <= max) {
+            break;
+        }
+
+    } while (!ngx_atomic_cmp_set(&st->max_queue, max, ti.tcpi_unacked));
+
+    if (ti.tcpi_unacked >= ti.tcpi_sacked) {
+        (void) ngx_atomic_fetch_add(&st->full, 1);
+    }
+
+#endif
+}
+
+#endif
+
+
 u_char *
 ngx_accept_log_error(ngx_log_t *log, u_char *buf, size_t len)
 {
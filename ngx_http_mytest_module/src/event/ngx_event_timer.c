@@ -10,6 +10,8 @@
 #include <ngx_event.h>
 
 
+#if !(NGX_TIMER_WHEEL)
+
 ngx_rbtree_t              ngx_event_timer_rbtree;
 static ngx_rbtree_node_t  ngx_event_timer_sentinel;
 
@@ -136,3 +138,369 @@ ngx_event_cancel_timers(void)
         ev->handler(ev);
     }
 }
+
+#endif
+
+
+#if (NGX_TIMER_WHEEL)
+
+/*
+ * The timers expiring within NGX_TIMER_WHEEL_SIZE milliseconds are kept
+ * in the first level slot of their expiry time, the later ones are kept
+ * in the slot of the next level which round they expire in.  When the
+ * wheel time enters a new round of a level, the slot of the round is
+ * cascaded down.  Insertion and deletion are O(1), the bitmaps of
+ * possibly non-empty slots are used to find the nearest timer and to skip
+ * empty slots, they are cleared lazily.
+ */
+
+#define ngx_event_timer_wheel_shift(level)  ((level) * NGX_TIMER_WHEEL_BITS)
+
+#define ngx_event_timer_wheel_set(level, n)                                   \
+    ngx_event_timer_wheel.map[level][(n) >> 5] |= (uint32_t) 1 << ((n) & 31)
+
+#define ngx_event_timer_wheel_clear(level, n)                                 \
+    ngx_event_timer_wheel.map[level][(n) >> 5] &= ~((uint32_t) 1 << ((n) & 31))
+
+
+static void ngx_event_timer_wheel_link(ngx_event_t *ev);
+static ngx_int_t ngx_event_timer_wheel_next(ngx_uint_t level, ngx_uint_t n,
+    ngx_uint_t len);
+static void ngx_event_timer_wheel_cascade(void);
+static void ngx_event_timer_wheel_expire(ngx_queue_t *slot);
+
+
+ngx_event_timer_wheel_t  ngx_event_timer_wheel;
+
+
+ngx_int_t
+ngx_event_timer_init(ngx_log_t *log)
+{
+    ngx_uint_t  i, n;
+
+    ngx_memzero(ngx_event_timer_wheel.map, sizeof(ngx_event_timer_wheel.map));
+
+    for (i = 0; i < NGX_TIMER_WHEEL_LEVELS; i++) {
+        for (n = 0; n < NGX_TIMER_WHEEL_SIZE; n++) {
+            ngx_queue_init(&ngx_event_timer_wheel.slots[i][n]);
+        }
+    }
+
+    ngx_event_timer_wheel.now = ngx_current_msec;
+    ngx_event_timer_wheel.count = 0;
+
+    return NGX_OK;
+}
+
+
+void
+ngx_event_timer_wheel_insert(ngx_event_t *ev)
+{
+    ngx_event_timer_wheel_link(ev);
+
+    ngx_event_timer_wheel.count++;
+}
+
+
+static void
+ngx_event_timer_wheel_link(ngx_event_t *ev)
+{
+    ngx_uint_t  level, n;
+    ngx_msec_t  key, delta;
+
+    key = ev->timer.key;
+    delta = key - ngx_event_timer_wheel.now;
+
+    if ((ngx_msec_int_t) delta < 0) {
+        /* an overdue timer expires with the current slot */
+        key = ngx_event_timer_wheel.now;
+        delta = 0;
+    }
+
+    /* the last level is limited to the rounds that do not wrap */
+
+    if (delta >= (ngx_msec_t) NGX_TIMER_WHEEL_MASK
+                 << ngx_event_timer_wheel_shift(NGX_TIMER_WHEEL_LEVELS - 1))
+    {
+        delta = (ngx_msec_t) NGX_TIMER_WHEEL_MASK
+                << ngx_event_timer_wheel_shift(NGX_TIMER_WHEEL_LEVELS - 1);
+        key = ngx_event_timer_wheel.now + delta;
+    }
+
+    for (level = 0; level < NGX_TIMER_WHEEL_LEVELS - 1; level++) {
+        if ((delta >> ngx_event_timer_wheel_shift(level + 1)) == 0) {
+            break;
+        }
+    }
+
+    n = (key >> ngx_event_timer_wheel_shift(level)) & NGX_TIMER_WHEEL_MASK;
+
+    ngx_queue_insert_tail(&ngx_event_timer_wheel.slots[level][n],
+                          &ev->timer_link);
+
+    ngx_event_timer_wheel_set(level, n);
+}
+
+
+ngx_msec_t
+ngx_event_find_timer(void)
+{
+    ngx_int_t       d;
+    ngx_uint_t      level, n, shift;
+    ngx_msec_t      now, start;
+    ngx_msec_int_t  timer, min;
+
+    if (ngx_event_timer_wheel.count == 0) {
+        return NGX_TIMER_INFINITE;
+    }
+
+    now = ngx_event_timer_wheel.now;
+    min = NGX_MAX_INT_T_VALUE;
+
+    for (level = 0; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+        shift = ngx_event_timer_wheel_shift(level);
+        n = (now >> shift) & NGX_TIMER_WHEEL_MASK;
+
+        if (level == 0) {
+            d = ngx_event_timer_wheel_next(0, n, NGX_TIMER_WHEEL_SIZE);
+
+            if (d == NGX_ERROR) {
+                continue;
+            }
+
+            start = now + d;
+
+        } else {
+
+            /*
+             * the current round of a next level has already been cascaded,
+             * the start of the round found is a lower bound of its timers;
+             * the current slot is scanned last, as a timer close to the span
+             * of the level may wrap into it, and then expires in its next
+             * round
+             */
+
+            d = ngx_event_timer_wheel_next(level, n + 1, NGX_TIMER_WHEEL_SIZE);
+
+            if (d == NGX_ERROR) {
+                continue;
+            }
+
+            start = ((now >> shift) + d + 1) << shift;
+        }
+
+        timer = (ngx_msec_int_t) (start - ngx_current_msec);
+
+        if (timer < min) {
+            min = timer;
+        }
+    }
+
+    if (min == NGX_MAX_INT_T_VALUE) {
+        return NGX_TIMER_INFINITE;
+    }
+
+    return (ngx_msec_t) (min > 0 ? min : 0);
+}
+
+
+void
+ngx_event_expire_timers(void)
+{
+    ngx_int_t   d;
+    ngx_uint_t  n, left;
+    ngx_msec_t  now;
+
+    if (ngx_event_timer_wheel.count == 0) {
+        ngx_event_timer_wheel.now = ngx_current_msec;
+        return;
+    }
+
+    for ( ;; ) {
+        now = ngx_event_timer_wheel.now;
+        n = now & NGX_TIMER_WHEEL_MASK;
+
+        ngx_event_timer_wheel_expire(&ngx_event_timer_wheel.slots[0][n]);
+        ngx_event_timer_wheel_clear(0, n);
+
+        if ((ngx_msec_int_t) (ngx_current_msec - now) <= 0) {
+            return;
+        }
+
+        /* skip the empty slots up to the end of the round */
+
+        left = ngx_min(NGX_TIMER_WHEEL_MASK - n,
+                       (ngx_uint_t) (ngx_current_msec - now));
+
+        if (left) {
+            d = ngx_event_timer_wheel_next(0, n + 1, left);
+
+            if (d != NGX_ERROR) {
+                ngx_event_timer_wheel.now = now + d + 1;
+                continue;
+            }
+        }
+
+        if ((ngx_uint_t) (ngx_current_msec - now) <= NGX_TIMER_WHEEL_MASK - n) {
+            /* the current time is within the round */
+            ngx_event_timer_wheel.now = ngx_current_msec;
+            continue;
+        }
+
+        ngx_event_timer_wheel.now = now + (NGX_TIMER_WHEEL_MASK - n) + 1;
+
+        ngx_event_timer_wheel_cascade();
+    }
+}
+
+
+void
+ngx_event_cancel_timers(void)
+{
+    ngx_uint_t    level, n;
+    ngx_queue_t  *slot, *q, *next, cancel;
+    ngx_event_t  *ev;
+
+    /* the cancelable timers are taken out first, the handlers may add more */
+
+    ngx_queue_init(&cancel);
+
+    for (level = 0; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+        for (n = 0; n < NGX_TIMER_WHEEL_SIZE; n++) {
+
+            slot = &ngx_event_timer_wheel.slots[level][n];
+
+            for (q = ngx_queue_head(slot);
+                 q != ngx_queue_sentinel(slot);
+                 q = next)
+            {
+                next = ngx_queue_next(q);
+
+                ev = ngx_queue_data(q, ngx_event_t, timer_link);
+
+                if (ev->cancelable) {
+                    ngx_queue_remove(q);
+                    ngx_queue_insert_tail(&cancel, q);
+                }
+            }
+        }
+    }
+
+    while (!ngx_queue_empty(&cancel)) {
+        q = ngx_queue_head(&cancel);
+        ev = ngx_queue_data(q, ngx_event_t, timer_link);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "event timer cancel: %d: %M",
+                       ngx_event_ident(ev->data), ev->timer.key);
+
+        ngx_queue_remove(q);
+        ngx_event_timer_wheel.count--;
+
+        ev->timer_set = 0;
+
+        ev->handler(ev);
+    }
+}
+
+
+static ngx_int_t
+ngx_event_timer_wheel_next(ngx_uint_t level, ngx_uint_t n, ngx_uint_t len)
+{
+    uint32_t    bits;
+    ngx_uint_t  i, k;
+
+    /* the distance from n to the first non-empty slot within len slots */
+
+    for (i = 0; i < len; /* void */ ) {
+        k = (n + i) & NGX_TIMER_WHEEL_MASK;
+
+        bits = ngx_event_timer_wheel.map[level][k >> 5] >> (k & 31);
+
+        if (bits == 0) {
+            i += 32 - (k & 31);
+            continue;
+        }
+
+        if (bits & 1) {
+            if (!ngx_queue_empty(&ngx_event_timer_wheel.slots[level][k])) {
+                return i;
+            }
+
+            ngx_event_timer_wheel_clear(level, k);
+        }
+
+        i++;
+    }
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_event_timer_wheel_cascade(void)
+{
+    ngx_uint_t    level, n;
+    ngx_queue_t  *slot, *q, timers;
+    ngx_event_t  *ev;
+
+    /* the wheel time has just entered a new round of the first level */
+
+    for (level = 1; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+        n = (ngx_event_timer_wheel.now >> ngx_event_timer_wheel_shift(level))
+            & NGX_TIMER_WHEEL_MASK;
+
+        slot = &ngx_event_timer_wheel.slots[level][n];
+
+        if (!ngx_queue_empty(slot)) {
+            ngx_queue_init(&timers);
+            ngx_queue_add(&timers, slot);
+            ngx_queue_init(slot);
+
+            while (!ngx_queue_empty(&timers)) {
+                q = ngx_queue_head(&timers);
+                ngx_queue_remove(q);
+
+                ev = ngx_queue_data(q, ngx_event_t, timer_link);
+
+                ngx_event_timer_wheel_link(ev);
+            }
+        }
+
+        ngx_event_timer_wheel_clear(level, n);
+
+        if (n) {
+            break;
+        }
+    }
+}
+
+
+static void
+ngx_event_timer_wheel_expire(ngx_queue_t *slot)
+{
+    ngx_queue_t  *q;
+    ngx_event_t  *ev;
+
+    /* the handlers may add timers to the same slot */
+
+    while (!ngx_queue_empty(slot)) {
+        q = ngx_queue_head(slot);
+        ev = ngx_queue_data(q, ngx_event_t, timer_link);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "event timer del: %d: %M",
+                       ngx_event_ident(ev->data), ev->timer.key);
+
+        ngx_queue_remove(q);
+        ngx_event_timer_wheel.count--;
+
+        ev->timer_set = 0;
+
+        ev->timedout = 1;
+
+        ev->handler(ev);
+    }
+}
+
+#endif
@@ -25,8 +25,43 @@ void ngx_event_expire_timers(void);
 void ngx_event_cancel_timers(void);
 
 
+#if (NGX_TIMER_WHEEL)
+
+/*
+ * a hierarchical timing wheel: the first level has a slot per millisecond,
+ * each next level has a slot per round of the previous one
+ */
+
+#define NGX_TIMER_WHEEL_BITS    8
+#define NGX_TIMER_WHEEL_SIZE    (1 << NGX_TIMER_WHEEL_BITS)
+#define NGX_TIMER_WHEEL_MASK    (NGX_TIMER_WHEEL_SIZE - 1)
+#define NGX_TIMER_WHEEL_LEVELS  4
+
+
+typedef struct {
+    ngx_msec_t        now;
+    ngx_uint_t        count;
+    uint32_t          map[NGX_TIMER_WHEEL_LEVELS][NGX_TIMER_WHEEL_SIZE / 32];
+    ngx_queue_t       slots[NGX_TIMER_WHEEL_LEVELS][NGX_TIMER_WHEEL_SIZE];
+} ngx_event_timer_wheel_t;
+
+
+void ngx_event_timer_wheel_insert(ngx_event_t *ev);
+
+
+extern ngx_event_timer_wheel_t  ngx_event_timer_wheel;
+
+#define ngx_event_timer_empty()  (ngx_event_timer_wheel.count == 0)
+
+#else
+
 extern ngx_rbtree_t  ngx_event_timer_rbtree;
 
+#define ngx_event_timer_empty()                                               \
+    (ngx_event_timer_rbtree.root == ngx_event_timer_rbtree.sentinel)
+
+#endif
+
 
 static ngx_inline void
 ngx_event_del_timer(ngx_event_t *ev)
@@ -35,12 +70,21 @@ ngx_event_del_timer(ngx_event_t *ev)
                    "event timer del: %d: %M",
                     ngx_event_ident(ev->data), ev->timer.key);
 
+#if (NGX_TIMER_WHEEL)
+
+    ngx_queue_remove(&ev->timer_link);
+    ngx_event_timer_wheel.count--;
+
+#else
+
     ngx_rbtree_delete(&ngx_event_timer_rbtree, &ev->timer);
 
 #if (NGX_DEBUG)
     ev->timer.left = NULL;
     ev->timer.right = NULL;
     ev->timer.parent = NULL;
+#endif
+
 #endif
 
     ev->timer_set = 0;
@@ -81,7 +125,11 @@ ngx_event_add_timer(ngx_event_t *ev, ngx_msec_t timer)
                    "event timer add: %d: %M:%M",
                     ngx_event_ident(ev->data), timer, ev->timer.key);
 
+#if (NGX_TIMER_WHEEL)
+    ngx_event_timer_wheel_insert(ev);
+#else
     ngx_rbtree_insert(&ngx_event_timer_rbtree, &ev->timer);
+#endif
 
     ev->timer_set = 1;
 }
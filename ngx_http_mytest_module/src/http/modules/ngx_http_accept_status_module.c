@@ -0,0 +1,360 @@
+
+/*
+ * Accept statistics of listening sockets.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_ACCEPT_STATUS_NETSTAT  16384
+
+
+static ngx_int_t ngx_http_accept_status_handler(ngx_http_request_t *r);
+static u_char *ngx_http_accept_status_listening(u_char *p,
+    ngx_listening_t *ls);
+#if (NGX_LINUX)
+static u_char *ngx_http_accept_status_netstat(ngx_http_request_t *r,
+    u_char *p);
+static ngx_int_t ngx_http_accept_status_netstat_value(u_char *buf,
+    u_char *last, char *name);
+#endif
+static char *ngx_http_set_accept_status(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_accept_status_commands[] = {
+
+    { ngx_string("accept_status"),
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_set_accept_status,
+      0,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_accept_status_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_accept_status_module = {
+    NGX_MODULE_V1,
+    &ngx_http_accept_status_module_ctx,    /* module context */
+    ngx_http_accept_status_commands,       /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+#define NGX_HTTP_ACCEPT_STATUS_HEADER                                         \
+    "listen accepted loops empty limited max_batch queue backlog "            \
+    "max_queue full\n"
+
+
+static ngx_int_t
+ngx_http_accept_status_handler(ngx_http_request_t *r)
+{
+    size_t             size;
+    ngx_int_t          rc;
+    ngx_buf_t         *b;
+    ngx_uint_t         i;
+    ngx_chain_t        out;
+    ngx_cycle_t       *cycle;
+    ngx_listening_t   *ls;
+    ngx_event_conf_t  *ecf;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    r->headers_out.content_type_len = sizeof("text/plain") - 1;
+    ngx_str_set(&r->headers_out.content_type, "text/plain");
+    r->headers_out.content_type_lowcase = NULL;
+
+    if (r->method == NGX_HTTP_HEAD) {
+        r->headers_out.status = NGX_HTTP_OK;
+
+        rc = ngx_http_send_header(r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+            return rc;
+        }
+    }
+
+    cycle = (ngx_cycle_t *) ngx_cycle;
+
+    ecf = ngx_event_get_conf(cycle->conf_ctx, ngx_event_core_module);
+
+    ls = cycle->listening.elts;
+
+    size = sizeof("accept_batch: \n") - 1 + NGX_INT_T_LEN
+           + sizeof(NGX_HTTP_ACCEPT_STATUS_HEADER) - 1
+           + sizeof("listen overflows: , drops: \n") - 1
+           + 2 * NGX_INT_T_LEN;
+
+    for (i = 0; i < cycle->listening.nelts; i++) {
+        size += ls[i].addr_text.len + sizeof(" #") - 1 + NGX_INT_T_LEN
+                + 9 * (NGX_ATOMIC_T_LEN + 1);
+    }
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    out.buf = b;
+    out.next = NULL;
+
+    b->last = ngx_sprintf(b->last, "accept_batch: %i\n", ecf->accept_batch);
+
+    b->last = ngx_cpymem(b->last, NGX_HTTP_ACCEPT_STATUS_HEADER,
+                         sizeof(NGX_HTTP_ACCEPT_STATUS_HEADER) - 1);
+
+    for (i = 0; i < cycle->listening.nelts; i++) {
+        b->last = ngx_http_accept_status_listening(b->last, &ls[i]);
+    }
+
+#if (NGX_LINUX)
+    b->last = ngx_http_accept_status_netstat(r, b->last);
+#endif
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static u_char *
+ngx_http_accept_status_listening(u_char *p, ngx_listening_t *ls)
+{
+    ngx_int_t              queue, backlog;
+    ngx_listening_stat_t  *st;
+#if (NGX_LINUX && NGX_HAVE_TCP_INFO)
+    socklen_t              len;
+    struct tcp_info        ti;
+#endif
+
+    st = ls->stat;
+
+    if (st == NULL || ls->fd == (ngx_socket_t) -1) {
+        return p;
+    }
+
+    p = ngx_cpymem(p, ls->addr_text.data, ls->addr_text.len);
+
+#if (NGX_HAVE_REUSEPORT)
+    if (ls->reuseport) {
+        p = ngx_sprintf(p, " #%ui", ls->worker);
+    }
+#endif
+
+    /* the current accept queue, as with ngx_event_accept_stat() */
+
+    queue = -1;
+    backlog = ls->backlog;
+
+#if (NGX_LINUX && NGX_HAVE_TCP_INFO)
+
+    len = sizeof(struct tcp_info);
+
+    if (getsockopt(ls->fd, IPPROTO_TCP, TCP_INFO, &ti, &len) != -1) {
+        queue = ti.tcpi_unacked;
+        backlog = ti.tcpi_sacked;
+    }
+
+#endif
+
+    return ngx_sprintf(p, " %uA %uA %uA %uA %uA %i %i %uA %uA\n",
+                       st->accepted, st->loops, st->empty, st->limited,
+                       st->max_batch, queue, backlog, st->max_queue,
+                       st->full);
+}
+
+
+#if (NGX_LINUX)
+
+static u_char *
+ngx_http_accept_status_netstat(ngx_http_request_t *r, u_char *p)
+{
+    u_char      *buf, *last;
+    ssize_t      n;
+    ngx_fd_t     fd;
+    ngx_int_t    overflows, drops;
+
+    /* the counters are system-wide, the kernel has none per socket */
+
+    fd = ngx_open_file("/proc/net/netstat", NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, ngx_errno,
+                      ngx_open_file_n " \"/proc/net/netstat\" failed");
+        return p;
+    }
+
+    buf = ngx_pnalloc(r->pool, NGX_HTTP_ACCEPT_STATUS_NETSTAT);
+    if (buf == NULL) {
+        ngx_close_file(fd);
+        return p;
+    }
+
+    last = buf;
+
+    do {
+        n = ngx_read_fd(fd, last, buf + NGX_HTTP_ACCEPT_STATUS_NETSTAT - last);
+
+        if (n == -1) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, ngx_errno,
+                          ngx_read_fd_n " \"/proc/net/netstat\" failed");
+            ngx_close_file(fd);
+            return p;
+        }
+
+        last += n;
+
+    } while (n && last < buf + NGX_HTTP_ACCEPT_STATUS_NETSTAT);
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                      ngx_close_file_n " \"/proc/net/netstat\" failed");
+    }
+
+    overflows = ngx_http_accept_status_netstat_value(buf, last,
+                                                     "ListenOverflows");
+    drops = ngx_http_accept_status_netstat_value(buf, last, "ListenDrops");
+
+    if (overflows == NGX_ERROR || drops == NGX_ERROR) {
+        return p;
+    }
+
+    return ngx_sprintf(p, "listen overflows: %i, drops: %i\n",
+                       overflows, drops);
+}
+
+
+static ngx_int_t
+ngx_http_accept_status_netstat_value(u_char *buf, u_char *last, char *name)
+{
+    u_char  *p, *q, *names, *values, *end;
+    size_t   len;
+
+    /*
+     * "TcpExt: name1 name2 ...\n"
+     * "TcpExt: value1 value2 ...\n"
+     */
+
+    len = ngx_strlen(name);
+
+    for (p = buf; p < last; p++) {
+
+        if ((p == buf || p[-1] == LF)
+            && (size_t) (last - p) > sizeof("TcpExt: ") - 1
+            && ngx_strncmp(p, "TcpExt: ", sizeof("TcpExt: ") - 1) == 0)
+        {
+            break;
+        }
+    }
+
+    if (p == last) {
+        return NGX_ERROR;
+    }
+
+    names = p + sizeof("TcpExt: ") - 1;
+
+    end = ngx_strlchr(names, last, LF);
+    if (end == NULL) {
+        return NGX_ERROR;
+    }
+
+    values = end + 1 + sizeof("TcpExt: ") - 1;
+
+    if (values >= last
+        || ngx_strncmp(end + 1, "TcpExt: ", sizeof("TcpExt: ") - 1) != 0)
+    {
+        return NGX_ERROR;
+    }
+
+    for (p = names; p < end; /* void */) {
+
+        if ((size_t) (end - p) >= len
+            && ngx_strncmp(p, name, len) == 0
+            && (p + len == end || p[len] == ' '))
+        {
+            for (q = values; q < last && *q >= '0' && *q <= '9'; q++) {
+                /* void */
+            }
+
+            return ngx_atoi(values, q - values);
+        }
+
+        p = ngx_strlchr(p, end, ' ');
+        if (p == NULL) {
+            break;
+        }
+
+        p++;
+
+        /* the value of the next name */
+
+        values = ngx_strlchr(values, last, ' ');
+        if (values == NULL) {
+            break;
+        }
+
+        values++;
+    }
+
+    return NGX_ERROR;
+}
+
+#endif
+
+
+static char *
+ngx_http_set_accept_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_accept_status_handler;
+
+    return NGX_CONF_OK;
+}
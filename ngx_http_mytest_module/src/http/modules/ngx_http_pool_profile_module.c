@@ -0,0 +1,355 @@
+
+/*
+ * Pool allocation profile per call site.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+typedef struct {
+    ngx_shm_zone_t  *shm_zone;
+} ngx_http_pool_profile_main_conf_t;
+
+
+static ngx_int_t ngx_http_pool_profile_handler(ngx_http_request_t *r);
+static int ngx_libc_cdecl ngx_http_pool_profile_cmp_sites(const void *one,
+    const void *two);
+static ngx_int_t ngx_http_pool_profile_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static void *ngx_http_pool_profile_create_main_conf(ngx_conf_t *cf);
+static char *ngx_http_pool_profile_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_pool_profile(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_int_t ngx_http_pool_profile_init_module(ngx_cycle_t *cycle);
+
+
+static ngx_command_t  ngx_http_pool_profile_commands[] = {
+
+    { ngx_string("pool_profile_zone"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_http_pool_profile_zone,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("pool_profile"),
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_pool_profile,
+      0,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_pool_profile_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    ngx_http_pool_profile_create_main_conf, /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_pool_profile_module = {
+    NGX_MODULE_V1,
+    &ngx_http_pool_profile_module_ctx,     /* module context */
+    ngx_http_pool_profile_commands,        /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    ngx_http_pool_profile_init_module,     /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_pool_profile_handler(ngx_http_request_t *r)
+{
+    size_t                    size;
+    ngx_int_t                 rc;
+    ngx_buf_t                *b;
+    ngx_uint_t                i, n, used;
+    ngx_chain_t               out;
+    ngx_pool_profile_t       *pp;
+    ngx_pool_profile_site_t  *sites;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    pp = ngx_pool_profile;
+
+    if (pp == NULL) {
+        return NGX_HTTP_NOT_FOUND;
+    }
+
+    r->headers_out.content_type_len = sizeof("text/plain") - 1;
+    ngx_str_set(&r->headers_out.content_type, "text/plain");
+    r->headers_out.content_type_lowcase = NULL;
+
+    if (r->method == NGX_HTTP_HEAD) {
+        r->headers_out.status = NGX_HTTP_OK;
+
+        rc = ngx_http_send_header(r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+            return rc;
+        }
+    }
+
+    /* take a snapshot, the sites are updated while the table is printed */
+
+    used = pp->used;
+
+    sites = ngx_palloc(r->pool, (used + 1) * sizeof(ngx_pool_profile_site_t));
+    if (sites == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    n = 0;
+
+    for (i = 0; i < pp->nsites && n < used; i++) {
+        if (pp->sites[i].line) {
+            sites[n++] = pp->sites[i];
+        }
+    }
+
+    ngx_qsort(sites, n, sizeof(ngx_pool_profile_site_t),
+              ngx_http_pool_profile_cmp_sites);
+
+    size = sizeof("sites: , dropped: \n") - 1 + 2 * NGX_ATOMIC_T_LEN
+           + sizeof("pool cache: hits, misses, blocks, bytes\n") - 1
+           + 4 * (NGX_ATOMIC_T_LEN + 1)
+           + sizeof("bytes calls large large_bytes site\n") - 1
+           + n * (4 * (NGX_ATOMIC_T_LEN + 1) + NGX_POOL_PROFILE_NAME_LEN
+                  + 1 + NGX_INT_T_LEN + 1);
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    out.buf = b;
+    out.next = NULL;
+
+    b->last = ngx_sprintf(b->last, "sites: %ui, dropped: %uA\n",
+                          n, pp->dropped);
+
+    /* the pool block cache is per process, these are of this worker */
+
+    b->last = ngx_sprintf(b->last,
+                          "pool cache: %ui hits, %ui misses, %ui blocks, "
+                          "%uz bytes\n",
+                          ngx_pool_cache_stat.hits, ngx_pool_cache_stat.misses,
+                          ngx_pool_cache_stat.blocks,
+                          ngx_pool_cache_stat.size);
+
+    b->last = ngx_cpymem(b->last, "bytes calls large large_bytes site\n",
+                         sizeof("bytes calls large large_bytes site\n") - 1);
+
+    for (i = 0; i < n; i++) {
+        b->last = ngx_sprintf(b->last, "%uA %uA %uA %uA %s:%ui\n",
+                              sites[i].bytes, sites[i].calls,
+                              sites[i].large, sites[i].large_bytes,
+                              sites[i].name, sites[i].line);
+    }
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static int ngx_libc_cdecl
+ngx_http_pool_profile_cmp_sites(const void *one, const void *two)
+{
+    ngx_pool_profile_site_t  *first, *second;
+
+    first = (ngx_pool_profile_site_t *) one;
+    second = (ngx_pool_profile_site_t *) two;
+
+    if (first->bytes == second->bytes) {
+        return 0;
+    }
+
+    return (first->bytes < second->bytes) ? 1 : -1;
+}
+
+
+static ngx_int_t
+ngx_http_pool_profile_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_pool_profile_t  *opp = data;
+
+    size_t               size;
+    ngx_uint_t           n;
+    ngx_slab_pool_t     *shpool;
+    ngx_pool_profile_t  *pp;
+
+    if (opp) {
+        shm_zone->data = opp;
+        return NGX_OK;
+    }
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        shm_zone->data = shpool->data;
+        return NGX_OK;
+    }
+
+    pp = ngx_slab_calloc(shpool, sizeof(ngx_pool_profile_t));
+    if (pp == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* a power of two number of sites in a half of the zone */
+
+    size = shm_zone->shm.size / 2;
+
+    for (n = 1; 2 * n * sizeof(ngx_pool_profile_site_t) <= size; n *= 2) {
+        /* void */
+    }
+
+    pp->sites = ngx_slab_calloc(shpool, n * sizeof(ngx_pool_profile_site_t));
+    if (pp->sites == NULL) {
+        return NGX_ERROR;
+    }
+
+    pp->nsites = n;
+
+    shpool->data = pp;
+    shm_zone->data = pp;
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_pool_profile_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_pool_profile_main_conf_t  *pmcf;
+
+    pmcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_pool_profile_main_conf_t));
+    if (pmcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     pmcf->shm_zone = NULL;
+     */
+
+    return pmcf;
+}
+
+
+static char *
+ngx_http_pool_profile_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_pool_profile_main_conf_t *pmcf = conf;
+
+    ssize_t     size;
+    ngx_str_t  *value, name;
+
+    if (pmcf->shm_zone) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    size = ngx_parse_size(&value[1]);
+
+    if (size == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone size \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (size < (ssize_t) (8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "zone \"%V\" is too small", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_str_set(&name, "pool_profile");
+
+    pmcf->shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                           &ngx_http_pool_profile_module);
+    if (pmcf->shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    pmcf->shm_zone->init = ngx_http_pool_profile_init_zone;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_pool_profile(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_pool_profile_handler;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_pool_profile_init_module(ngx_cycle_t *cycle)
+{
+    ngx_http_pool_profile_main_conf_t  *pmcf;
+
+    /*
+     * the zone is attached only now, when the new cycle cannot fail anymore:
+     * the table of the old cycle stays in use until then
+     */
+
+    pmcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                               ngx_http_pool_profile_module);
+
+    if (pmcf && pmcf->shm_zone) {
+        ngx_pool_profile = pmcf->shm_zone->data;
+
+    } else {
+        ngx_pool_profile = NULL;
+    }
+
+    return NGX_OK;
+}
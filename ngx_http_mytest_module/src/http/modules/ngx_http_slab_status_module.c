@@ -0,0 +1,255 @@
+
+/*
+ * Slab allocator statistics of shared memory zones.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+static ngx_int_t ngx_http_slab_status_handler(ngx_http_request_t *r);
+static u_char *ngx_http_slab_status_zone(u_char *p, ngx_shm_zone_t *shm_zone,
+    ngx_slab_stat_t *stats);
+static char *ngx_http_set_slab_status(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_slab_status_commands[] = {
+
+    { ngx_string("slab_status"),
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_set_slab_status,
+      0,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_slab_status_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_slab_status_module = {
+    NGX_MODULE_V1,
+    &ngx_http_slab_status_module_ctx,      /* module context */
+    ngx_http_slab_status_commands,         /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+#define NGX_HTTP_SLAB_STATUS_LINE  (6 * (NGX_INT_T_LEN + 1))
+
+
+static ngx_int_t
+ngx_http_slab_status_handler(ngx_http_request_t *r)
+{
+    size_t            size;
+    ngx_int_t         rc;
+    ngx_buf_t        *b;
+    ngx_uint_t        i, n;
+    ngx_chain_t       out;
+    ngx_cycle_t      *cycle;
+    ngx_shm_zone_t   *shm_zone;
+    ngx_slab_pool_t  *sp;
+    ngx_slab_stat_t  *stats;
+    ngx_list_part_t  *part;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    r->headers_out.content_type_len = sizeof("text/plain") - 1;
+    ngx_str_set(&r->headers_out.content_type, "text/plain");
+    r->headers_out.content_type_lowcase = NULL;
+
+    if (r->method == NGX_HTTP_HEAD) {
+        r->headers_out.status = NGX_HTTP_OK;
+
+        rc = ngx_http_send_header(r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+            return rc;
+        }
+    }
+
+    cycle = (ngx_cycle_t *) ngx_cycle;
+
+    size = 0;
+    n = 0;
+
+    part = &cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        sp = (ngx_slab_pool_t *) shm_zone[i].shm.addr;
+
+        size += sizeof("zone \"\": size:, pages:, free:\n") - 1
+                + shm_zone[i].shm.name.len + 3 * NGX_INT_T_LEN
+                + sizeof("size total used max reqs fails\n") - 1
+                + (ngx_pagesize_shift - sp->min_shift + 1)
+                  * NGX_HTTP_SLAB_STATUS_LINE
+                + sizeof("\n") - 1;
+
+        if (n < ngx_pagesize_shift - sp->min_shift + 1) {
+            n = ngx_pagesize_shift - sp->min_shift + 1;
+        }
+    }
+
+    if (size == 0) {
+        size = sizeof("no zones\n") - 1;
+    }
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    stats = ngx_palloc(r->pool, n * sizeof(ngx_slab_stat_t));
+    if (stats == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    out.buf = b;
+    out.next = NULL;
+
+    part = &cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        b->last = ngx_http_slab_status_zone(b->last, &shm_zone[i], stats);
+    }
+
+    if (b->last == b->pos) {
+        b->last = ngx_cpymem(b->last, "no zones\n", sizeof("no zones\n") - 1);
+    }
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static u_char *
+ngx_http_slab_status_zone(u_char *p, ngx_shm_zone_t *shm_zone,
+    ngx_slab_stat_t *stats)
+{
+    ngx_uint_t        i, n, pages, pfree;
+    ngx_slab_pool_t  *sp;
+
+    sp = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    /* slot sizes go from sp->min_size up to a half of a page */
+
+    n = ngx_pagesize_shift - sp->min_shift;
+
+    ngx_shmtx_lock(&sp->mutex);
+
+    ngx_memcpy(stats, sp->stats, (n + 1) * sizeof(ngx_slab_stat_t));
+    pages = sp->last - sp->pages;
+    pfree = sp->pfree;
+
+    ngx_shmtx_unlock(&sp->mutex);
+
+    p = ngx_sprintf(p, "zone \"%V\": size:%uz, pages:%ui, free:%ui\n",
+                    &shm_zone->shm.name, shm_zone->shm.size, pages, pfree);
+
+    p = ngx_cpymem(p, "size total used max reqs fails\n",
+                   sizeof("size total used max reqs fails\n") - 1);
+
+    for (i = 0; i < n; i++) {
+
+        if (stats[i].reqs == 0 && stats[i].total == 0) {
+            continue;
+        }
+
+        p = ngx_sprintf(p, "%uz %ui %ui %ui %ui %ui\n",
+                        (size_t) 1 << (sp->min_shift + i),
+                        stats[i].total, stats[i].used, stats[i].max,
+                        stats[i].reqs, stats[i].fails);
+    }
+
+    /* allocations of whole pages are counted in pages */
+
+    if (stats[n].reqs) {
+        p = ngx_sprintf(p, "page - %ui %ui %ui %ui\n",
+                        stats[n].used, stats[n].max,
+                        stats[n].reqs, stats[n].fails);
+    }
+
+    *p++ = '\n';
+
+    return p;
+}
+
+
+static char *
+ngx_http_set_slab_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_slab_status_handler;
+
+    return NGX_CONF_OK;
+}
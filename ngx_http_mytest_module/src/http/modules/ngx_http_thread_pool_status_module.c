@@ -0,0 +1,218 @@
+
+/*
+ * Thread pool statistics of a worker.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+#include <ngx_thread_pool.h>
+
+
+static ngx_int_t ngx_http_thread_pool_status_handler(ngx_http_request_t *r);
+static u_char *ngx_http_thread_pool_status_pool(u_char *p,
+    ngx_thread_pool_stat_t *st);
+static char *ngx_http_set_thread_pool_status(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+
+
+static ngx_command_t  ngx_http_thread_pool_status_commands[] = {
+
+    { ngx_string("thread_pool_status"),
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_set_thread_pool_status,
+      0,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_thread_pool_status_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_thread_pool_status_module = {
+    NGX_MODULE_V1,
+    &ngx_http_thread_pool_status_module_ctx, /* module context */
+    ngx_http_thread_pool_status_commands,  /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+#define NGX_HTTP_THREAD_POOL_STATUS_LINE  (3 * (NGX_INT_T_LEN + 1))
+
+
+static ngx_int_t
+ngx_http_thread_pool_status_handler(ngx_http_request_t *r)
+{
+    size_t                   size;
+    ngx_int_t                rc;
+    ngx_buf_t               *b;
+    ngx_uint_t               i;
+    ngx_array_t              stats;
+    ngx_chain_t              out;
+    ngx_thread_pool_stat_t  *st;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    r->headers_out.content_type_len = sizeof("text/plain") - 1;
+    ngx_str_set(&r->headers_out.content_type, "text/plain");
+    r->headers_out.content_type_lowcase = NULL;
+
+    if (r->method == NGX_HTTP_HEAD) {
+        r->headers_out.status = NGX_HTTP_OK;
+
+        rc = ngx_http_send_header(r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+            return rc;
+        }
+    }
+
+    /* the thread pools are per process, these are of this worker */
+
+    if (ngx_array_init(&stats, r->pool, 4, sizeof(ngx_thread_pool_stat_t))
+        != NGX_OK)
+    {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    size = 0;
+
+    for (i = 0; /* void */ ; i++) {
+
+        st = ngx_array_push(&stats);
+        if (st == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        if (ngx_thread_pool_stat((ngx_cycle_t *) ngx_cycle, i, st) != NGX_OK) {
+            stats.nelts--;
+            break;
+        }
+
+        size += sizeof("pool \"\": threads:, max_queue:, queued:, "
+                       "overflows:\n") - 1
+                + st->name.len + 4 * NGX_INT_T_LEN
+                + sizeof("tasks:, steals:, notifies:, wait:us, exec:us\n") - 1
+                + 3 * NGX_INT_T_LEN + 2 * NGX_INT64_LEN
+                + sizeof("usec wait exec\n") - 1
+                + NGX_THREAD_POOL_HIST * NGX_HTTP_THREAD_POOL_STATUS_LINE
+                + sizeof("\n") - 1;
+    }
+
+    if (size == 0) {
+        size = sizeof("no thread pools\n") - 1;
+    }
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    out.buf = b;
+    out.next = NULL;
+
+    st = stats.elts;
+
+    for (i = 0; i < stats.nelts; i++) {
+        b->last = ngx_http_thread_pool_status_pool(b->last, &st[i]);
+    }
+
+    if (b->last == b->pos) {
+        b->last = ngx_cpymem(b->last, "no thread pools\n",
+                             sizeof("no thread pools\n") - 1);
+    }
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static u_char *
+ngx_http_thread_pool_status_pool(u_char *p, ngx_thread_pool_stat_t *st)
+{
+    ngx_uint_t  i;
+
+    p = ngx_sprintf(p, "pool \"%V\": threads:%ui, max_queue:%i, queued:%ui, "
+                    "overflows:%ui\n",
+                    &st->name, st->threads, st->max_queue, st->queued,
+                    st->overflows);
+
+    p = ngx_sprintf(p, "tasks:%ui, steals:%ui, notifies:%ui, "
+                    "wait:%uLus, exec:%uLus\n",
+                    st->tasks, st->steals, st->notifies,
+                    st->wait_time, st->exec_time);
+
+    p = ngx_cpymem(p, "usec wait exec\n", sizeof("usec wait exec\n") - 1);
+
+    /* the lower bounds of log2 buckets, the last one is unbounded */
+
+    for (i = 0; i < NGX_THREAD_POOL_HIST; i++) {
+
+        if (st->wait[i] == 0 && st->exec[i] == 0) {
+            continue;
+        }
+
+        p = ngx_sprintf(p, "%ui %ui %ui\n",
+                        i ? (ngx_uint_t) 1 << i : 0, st->wait[i], st->exec[i]);
+    }
+
+    *p++ = '\n';
+
+    return p;
+}
+
+
+static char *
+ngx_http_set_thread_pool_status(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_thread_pool_status_handler;
+
+    return NGX_CONF_OK;
+}
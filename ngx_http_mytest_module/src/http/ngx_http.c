@@ -437,6 +437,67 @@ ngx_http_init_headers_in_hash(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf)
         return NGX_ERROR;
     }
 
+    return ngx_http_headers_phash_init(cf, &cmcf->headers_in_phash,
+                                       headers_in.elts, headers_in.nelts);
+}
+
+
+ngx_int_t
+ngx_http_headers_phash_init(ngx_conf_t *cf, ngx_http_headers_phash_t *ph,
+    ngx_hash_key_t *names, ngx_uint_t nelts)
+{
+    ngx_uint_t       i, n;
+    ngx_hash_key_t  *elts;
+
+    ngx_memzero(ph->index, NGX_HTTP_HEADERS_PHASH);
+    ph->elts = NULL;
+
+    if (nelts > 255) {
+        goto failed;
+    }
+
+    elts = ngx_palloc(cf->pool, nelts * sizeof(ngx_hash_key_t));
+    if (elts == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < nelts; i++) {
+        n = names[i].key_hash % NGX_HTTP_HEADERS_PHASH;
+
+        if (ph->index[n]) {
+            goto failed;
+        }
+
+        ph->index[n] = (u_char) (i + 1);
+
+        /* the parser passes lowercased names */
+
+        elts[i].key.len = names[i].key.len;
+        elts[i].key.data = ngx_pnalloc(cf->pool, names[i].key.len);
+        if (elts[i].key.data == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_strlow(elts[i].key.data, names[i].key.data, names[i].key.len);
+
+        elts[i].key_hash = names[i].key_hash;
+        elts[i].value = names[i].value;
+    }
+
+    ph->elts = elts;
+
+    return NGX_OK;
+
+failed:
+
+    /* lookups fall back to the regular hash */
+
+    ngx_memzero(ph->index, NGX_HTTP_HEADERS_PHASH);
+
+    ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                       "could not build perfect hash of %ui header names, "
+                       "NGX_HTTP_HEADERS_PHASH should be updated", nelts);
+
     return NGX_OK;
 }
 
@@ -1824,6 +1885,14 @@ ngx_http_add_listening(ngx_conf_t *cf, ngx_http_conf_addr_t *addr)
     ls->reuseport = addr->opt.reuseport;
 #endif
 
+#if (NGX_HAVE_REUSEPORT_CBPF)
+    ls->incoming_cpu = addr->opt.incoming_cpu;
+#endif
+
+#if (NGX_HAVE_SO_BUSY_POLL)
+    ls->busy_poll = addr->opt.busy_poll;
+#endif
+
     return ls;
 }
 
@@ -37,6 +37,7 @@ typedef u_char *(*ngx_http_log_handler_pt)(ngx_http_request_t *r,
 #include <ngx_http_upstream.h>
 #include <ngx_http_upstream_round_robin.h>
 #include <ngx_http_core_module.h>
+#include <ngx_http_fanout.h>
 
 #if (NGX_HTTP_V2)
 #include <ngx_http_v2.h>
@@ -160,12 +161,44 @@ char *ngx_http_merge_types(ngx_conf_t *cf, ngx_array_t **keys,
     ngx_hash_t *prev_types_hash, ngx_str_t *default_types);
 ngx_int_t ngx_http_set_default_types(ngx_conf_t *cf, ngx_array_t **types,
     ngx_str_t *default_type);
+ngx_int_t ngx_http_headers_phash_init(ngx_conf_t *cf,
+    ngx_http_headers_phash_t *ph, ngx_hash_key_t *names, ngx_uint_t nelts);
 
 #if (NGX_HTTP_DEGRADATION)
 ngx_uint_t  ngx_http_degraded(ngx_http_request_t *);
 #endif
 
 
+static ngx_inline void *
+ngx_http_headers_phash_find(ngx_http_headers_phash_t *ph, ngx_hash_t *hash,
+    ngx_uint_t key, u_char *name, size_t len)
+{
+    ngx_uint_t       n;
+    ngx_hash_key_t  *hk;
+
+    if (ph->elts == NULL) {
+        return ngx_hash_find(hash, key, name, len);
+    }
+
+    n = ph->index[key % NGX_HTTP_HEADERS_PHASH];
+
+    if (n == 0) {
+        return NULL;
+    }
+
+    hk = &ph->elts[n - 1];
+
+    if (hk->key_hash != key
+        || hk->key.len != len
+        || ngx_memcmp(hk->key.data, name, len) != 0)
+    {
+        return NULL;
+    }
+
+    return hk->value;
+}
+
+
 extern ngx_module_t  ngx_http_module;
 
 extern ngx_str_t  ngx_http_html_default_types[];
@@ -59,6 +59,10 @@ static char *ngx_http_core_set_aio(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_core_directio(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+#if (NGX_HAVE_FILE_READAHEAD)
+static char *ngx_http_core_file_readahead(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+#endif
 static char *ngx_http_core_error_page(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_core_try_files(ngx_conf_t *cf, ngx_command_t *cmd,
@@ -393,6 +397,17 @@ static ngx_command_t  ngx_http_core_commands[] = {
       offsetof(ngx_http_core_loc_conf_t, sendfile_max_chunk),
       NULL },
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+
+    { ngx_string("send_zerocopy"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_core_loc_conf_t, send_zerocopy),
+      NULL },
+
+#endif
+
     { ngx_string("aio"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_http_core_set_aio,
@@ -400,6 +415,17 @@ static ngx_command_t  ngx_http_core_commands[] = {
       0,
       NULL },
 
+#if (NGX_THREADS)
+
+    { ngx_string("aio_open"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_core_loc_conf_t, aio_open),
+      NULL },
+
+#endif
+
     { ngx_string("read_ahead"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_size_slot,
@@ -407,6 +433,17 @@ static ngx_command_t  ngx_http_core_commands[] = {
       offsetof(ngx_http_core_loc_conf_t, read_ahead),
       NULL },
 
+#if (NGX_HAVE_FILE_READAHEAD)
+
+    { ngx_string("file_readahead"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE12,
+      ngx_http_core_file_readahead,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+#endif
+
     { ngx_string("directio"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_http_core_directio,
@@ -1426,6 +1463,10 @@ ngx_http_update_location_config(ngx_http_request_t *r)
         r->connection->sendfile = 0;
     }
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+    (void) ngx_zerocopy_init(r->connection, clcf->send_zerocopy);
+#endif
+
     if (clcf->client_body_in_file_only) {
         r->request_body_in_file_only = 1;
         r->request_body_in_persistent_file = 1;
@@ -2766,6 +2807,27 @@ ngx_http_set_disable_symlinks(ngx_http_request_t *r,
 }
 
 
+void
+ngx_http_set_file_readahead(ngx_http_request_t *r,
+    ngx_http_core_loc_conf_t *clcf, ngx_file_t *file, off_t size)
+{
+#if (NGX_HAVE_FILE_READAHEAD)
+    file->readahead.size = clcf->file_readahead;
+    file->readahead.next = 0;
+    file->readahead.last = 0;
+
+    /*
+     * the pages of a file served once are dropped after the read,
+     * unless sendfile() is used, as it sends them after the read
+     */
+
+    file->readahead.drop = (clcf->file_readahead_drop
+                            && size >= clcf->file_readahead_drop
+                            && !r->connection->sendfile);
+#endif
+}
+
+
 ngx_int_t
 ngx_http_get_forwarded_addr(ngx_http_request_t *r, ngx_addr_t *addr,
     ngx_array_t *headers, ngx_str_t *value, ngx_array_t *proxies,
@@ -3045,6 +3107,9 @@ ngx_http_core_server(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy)
 #endif
 #if (NGX_HAVE_TCP_FASTOPEN)
         lsopt.fastopen = -1;
+#endif
+#if (NGX_HAVE_SO_BUSY_POLL)
+        lsopt.busy_poll = -1;
 #endif
         lsopt.wildcard = 1;
 
@@ -3607,12 +3672,20 @@ ngx_http_core_create_loc_conf(ngx_conf_t *cf)
     clcf->internal = NGX_CONF_UNSET;
     clcf->sendfile = NGX_CONF_UNSET;
     clcf->sendfile_max_chunk = NGX_CONF_UNSET_SIZE;
+#if (NGX_HAVE_MSG_ZEROCOPY)
+    clcf->send_zerocopy = NGX_CONF_UNSET_SIZE;
+#endif
     clcf->aio = NGX_CONF_UNSET;
 #if (NGX_THREADS)
     clcf->thread_pool = NGX_CONF_UNSET_PTR;
     clcf->thread_pool_value = NGX_CONF_UNSET_PTR;
+    clcf->aio_open = NGX_CONF_UNSET;
 #endif
     clcf->read_ahead = NGX_CONF_UNSET_SIZE;
+#if (NGX_HAVE_FILE_READAHEAD)
+    clcf->file_readahead = NGX_CONF_UNSET_SIZE;
+    clcf->file_readahead_drop = NGX_CONF_UNSET;
+#endif
     clcf->directio = NGX_CONF_UNSET;
     clcf->directio_alignment = NGX_CONF_UNSET;
     clcf->tcp_nopush = NGX_CONF_UNSET;
@@ -3827,6 +3900,9 @@ ngx_http_core_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_value(conf->sendfile, prev->sendfile, 0);
     ngx_conf_merge_size_value(conf->sendfile_max_chunk,
                               prev->sendfile_max_chunk, 0);
+#if (NGX_HAVE_MSG_ZEROCOPY)
+    ngx_conf_merge_size_value(conf->send_zerocopy, prev->send_zerocopy, 0);
+#endif
 #if (NGX_HAVE_FILE_AIO || NGX_THREADS)
     ngx_conf_merge_value(conf->aio, prev->aio, NGX_HTTP_AIO_OFF);
 #endif
@@ -3834,8 +3910,14 @@ ngx_http_core_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_ptr_value(conf->thread_pool, prev->thread_pool, NULL);
     ngx_conf_merge_ptr_value(conf->thread_pool_value, prev->thread_pool_value,
                              NULL);
+    ngx_conf_merge_value(conf->aio_open, prev->aio_open, 0);
 #endif
     ngx_conf_merge_size_value(conf->read_ahead, prev->read_ahead, 0);
+#if (NGX_HAVE_FILE_READAHEAD)
+    ngx_conf_merge_size_value(conf->file_readahead, prev->file_readahead, 0);
+    ngx_conf_merge_off_value(conf->file_readahead_drop,
+                              prev->file_readahead_drop, 0);
+#endif
     ngx_conf_merge_off_value(conf->directio, prev->directio,
                               NGX_OPEN_FILE_DIRECTIO_OFF);
     ngx_conf_merge_off_value(conf->directio_alignment, prev->directio_alignment,
@@ -4003,6 +4085,9 @@ ngx_http_core_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 #endif
 #if (NGX_HAVE_TCP_FASTOPEN)
     lsopt.fastopen = -1;
+#endif
+#if (NGX_HAVE_SO_BUSY_POLL)
+    lsopt.busy_poll = -1;
 #endif
     lsopt.wildcard = u.wildcard;
 #if (NGX_HAVE_INET6 && defined IPV6_V6ONLY)
@@ -4059,6 +4144,22 @@ ngx_http_core_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         }
 #endif
 
+#if (NGX_HAVE_SO_BUSY_POLL)
+        if (ngx_strncmp(value[n].data, "busy_poll=", 10) == 0) {
+            lsopt.busy_poll = ngx_atoi(value[n].data + 10, value[n].len - 10);
+            lsopt.set = 1;
+            lsopt.bind = 1;
+
+            if (lsopt.busy_poll == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid busy_poll \"%V\"", &value[n]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+#endif
+
         if (ngx_strncmp(value[n].data, "backlog=", 8) == 0) {
             lsopt.backlog = ngx_atoi(value[n].data + 8, value[n].len - 8);
             lsopt.set = 1;
@@ -4186,6 +4287,19 @@ ngx_http_core_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strcmp(value[n].data, "incoming_cpu") == 0) {
+#if (NGX_HAVE_REUSEPORT_CBPF)
+            lsopt.incoming_cpu = 1;
+            lsopt.set = 1;
+            lsopt.bind = 1;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "incoming_cpu is not supported "
+                               "on this platform, ignored");
+#endif
+            continue;
+        }
+
         if (ngx_strcmp(value[n].data, "ssl") == 0) {
 #if (NGX_HTTP_SSL)
             lsopt.ssl = 1;
@@ -4319,6 +4433,15 @@ ngx_http_core_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+#if (NGX_HAVE_REUSEPORT_CBPF)
+    if (lsopt.incoming_cpu && !lsopt.reuseport) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "the \"incoming_cpu\" parameter requires "
+                           "\"reuseport\"");
+        return NGX_CONF_ERROR;
+    }
+#endif
+
     if (ngx_http_add_listen(cf, cscf, &lsopt) == NGX_OK) {
         return NGX_CONF_OK;
     }
@@ -4788,6 +4911,70 @@ ngx_http_core_directio(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+#if (NGX_HAVE_FILE_READAHEAD)
+
+static char *
+ngx_http_core_file_readahead(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t *clcf = conf;
+
+    ngx_str_t  *value, s;
+
+    if (clcf->file_readahead != NGX_CONF_UNSET_SIZE) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    clcf->file_readahead_drop = 0;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+
+        if (cf->args->nelts == 3) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+
+        clcf->file_readahead = 0;
+        return NGX_CONF_OK;
+    }
+
+    clcf->file_readahead = ngx_parse_size(&value[1]);
+    if (clcf->file_readahead == (size_t) NGX_ERROR
+        || clcf->file_readahead == 0)
+    {
+        return "invalid value";
+    }
+
+    if (cf->args->nelts == 2) {
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strncmp(value[2].data, "drop=", 5) != 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[2]);
+        return NGX_CONF_ERROR;
+    }
+
+    s.len = value[2].len - 5;
+    s.data = value[2].data + 5;
+
+    clcf->file_readahead_drop = ngx_parse_offset(&s);
+    if (clcf->file_readahead_drop == (off_t) NGX_ERROR
+        || clcf->file_readahead_drop == 0)
+    {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid drop value \"%V\"", &value[2]);
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+#endif
+
+
 static char *
 ngx_http_core_error_page(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -87,6 +87,9 @@ typedef struct {
 #endif
 #if (NGX_HAVE_REUSEPORT)
     unsigned                   reuseport:1;
+#endif
+#if (NGX_HAVE_REUSEPORT_CBPF)
+    unsigned                   incoming_cpu:1;
 #endif
     unsigned                   so_keepalive:2;
     unsigned                   proxy_protocol:1;
@@ -100,6 +103,9 @@ typedef struct {
 #if (NGX_HAVE_TCP_FASTOPEN)
     int                        fastopen;
 #endif
+#if (NGX_HAVE_SO_BUSY_POLL)
+    int                        busy_poll;
+#endif
 #if (NGX_HAVE_KEEPALIVE_TUNABLE)
     int                        tcp_keepidle;
     int                        tcp_keepintvl;
@@ -170,6 +176,7 @@ typedef struct {
     ngx_http_phase_engine_t    phase_engine;
 
     ngx_hash_t                 headers_in_hash;
+    ngx_http_headers_phash_t   headers_in_phash;
 
     ngx_hash_t                 variables_hash;
 
@@ -382,6 +389,13 @@ struct ngx_http_core_loc_conf_s {
     size_t        limit_rate_after;        /* limit_rate_after */
     size_t        sendfile_max_chunk;      /* sendfile_max_chunk */
     size_t        read_ahead;              /* read_ahead */
+#if (NGX_HAVE_FILE_READAHEAD)
+    size_t        file_readahead;          /* file_readahead */
+    off_t         file_readahead_drop;
+#endif
+#if (NGX_HAVE_MSG_ZEROCOPY)
+    size_t        send_zerocopy;           /* send_zerocopy */
+#endif
 
     ngx_msec_t    client_body_timeout;     /* client_body_timeout */
     ngx_msec_t    send_timeout;            /* send_timeout */
@@ -435,6 +449,7 @@ struct ngx_http_core_loc_conf_s {
 #if (NGX_THREADS)
     ngx_thread_pool_t         *thread_pool;
     ngx_http_complex_value_t  *thread_pool_value;
+    ngx_flag_t                 aio_open;
 #endif
 
 #if (NGX_HAVE_OPENAT)
@@ -551,6 +566,8 @@ ngx_int_t ngx_http_request_body_save_filter(ngx_http_request_t *r,
 
 ngx_int_t ngx_http_set_disable_symlinks(ngx_http_request_t *r,
     ngx_http_core_loc_conf_t *clcf, ngx_str_t *path, ngx_open_file_info_t *of);
+void ngx_http_set_file_readahead(ngx_http_request_t *r,
+    ngx_http_core_loc_conf_t *clcf, ngx_file_t *file, off_t size);
 
 ngx_int_t ngx_http_get_forwarded_addr(ngx_http_request_t *r, ngx_addr_t *addr,
     ngx_array_t *headers, ngx_str_t *value, ngx_array_t *proxies,
@@ -0,0 +1,339 @@
+
+/*
+ * Fan-out and fan-in of parallel subrequests.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * Runs a set of subrequests concurrently and, once every branch has
+ * completed or the deadline has passed, installs fo->handler as the write
+ * event handler of the parent, which the subrequest finalization then
+ * wakes up.  The content handler returns what ngx_http_fanout_start()
+ * returned.  By default the subrequests are created with
+ * NGX_HTTP_SUBREQUEST_IN_MEMORY and branch->body points to the upstream
+ * response.
+ *
+ * A branch that runs out of time is recorded as timed out and its
+ * upstream is finalized with 504 in whatever state it is: resolving,
+ * connecting or reading, so the partial results are available at once.
+ */
+
+
+static ngx_int_t ngx_http_fanout_post_handler(ngx_http_request_t *r,
+    void *data, ngx_int_t rc);
+static void ngx_http_fanout_branch_done(ngx_http_fanout_branch_t *br);
+static void ngx_http_fanout_branch_timeout(ngx_event_t *ev);
+static void ngx_http_fanout_deadline(ngx_event_t *ev);
+static void ngx_http_fanout_abort(ngx_http_fanout_branch_t *br);
+static void ngx_http_fanout_cleanup(void *data);
+
+
+ngx_http_fanout_t *
+ngx_http_fanout_create(ngx_http_request_t *r, ngx_uint_t n)
+{
+    ngx_pool_cleanup_t  *cln;
+    ngx_http_fanout_t   *fo;
+
+    fo = ngx_pcalloc(r->pool, sizeof(ngx_http_fanout_t));
+    if (fo == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&fo->branches, r->pool, n,
+                       sizeof(ngx_http_fanout_branch_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    cln->handler = ngx_http_fanout_cleanup;
+    cln->data = fo;
+
+    fo->request = r;
+    fo->flags = NGX_HTTP_SUBREQUEST_IN_MEMORY;
+
+    fo->timer.handler = ngx_http_fanout_deadline;
+    fo->timer.data = fo;
+    fo->timer.log = r->connection->log;
+
+    return fo;
+}
+
+
+ngx_http_fanout_branch_t *
+ngx_http_fanout_add(ngx_http_fanout_t *fo, ngx_str_t *uri, ngx_str_t *args,
+    ngx_msec_t timeout)
+{
+    ngx_http_fanout_branch_t  *br;
+
+    if (fo->started) {
+        return NULL;
+    }
+
+    br = ngx_array_push(&fo->branches);
+    if (br == NULL) {
+        return NULL;
+    }
+
+    ngx_memzero(br, sizeof(ngx_http_fanout_branch_t));
+
+    br->uri = *uri;
+
+    if (args) {
+        br->args = *args;
+    }
+
+    br->timeout = timeout;
+    br->fanout = fo;
+
+    br->timer.handler = ngx_http_fanout_branch_timeout;
+    br->timer.data = br;
+    br->timer.log = fo->request->connection->log;
+
+    return br;
+}
+
+
+ngx_int_t
+ngx_http_fanout_start(ngx_http_fanout_t *fo)
+{
+    ngx_uint_t                   i;
+    ngx_http_request_t          *r, *sr;
+    ngx_http_fanout_branch_t    *br;
+    ngx_http_post_subrequest_t  *ps;
+
+    r = fo->request;
+    br = fo->branches.elts;
+
+    if (fo->started || fo->branches.nelts == 0 || fo->handler == NULL) {
+        return NGX_ERROR;
+    }
+
+    fo->started = 1;
+
+    /* all subrequests are created first: their upstreams run in parallel */
+
+    for (i = 0; i < fo->branches.nelts; i++) {
+
+        ps = ngx_palloc(r->pool, sizeof(ngx_http_post_subrequest_t));
+        if (ps == NULL) {
+            return NGX_ERROR;
+        }
+
+        ps->handler = ngx_http_fanout_post_handler;
+        ps->data = &br[i];
+
+        if (ngx_http_subrequest(r, &br[i].uri,
+                                br[i].args.len ? &br[i].args : NULL,
+                                &sr, ps, fo->flags)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        br[i].request = sr;
+        fo->pending++;
+
+        if (br[i].timeout) {
+            ngx_add_timer(&br[i].timer, br[i].timeout);
+        }
+    }
+
+    if (fo->deadline) {
+        ngx_add_timer(&fo->timer, fo->deadline);
+    }
+
+    /* the request is finalized with r->postponed set and waits */
+
+    return NGX_AGAIN;
+}
+
+
+static ngx_int_t
+ngx_http_fanout_post_handler(ngx_http_request_t *r, void *data, ngx_int_t rc)
+{
+    ngx_http_fanout_branch_t *br = data;
+
+    ngx_http_upstream_t  *u;
+
+    /* may be called again by the finalizer of a non-active subrequest */
+
+    if (br->done) {
+        return rc;
+    }
+
+    br->done = 1;
+
+    if (br->timer.timer_set) {
+        ngx_del_timer(&br->timer);
+    }
+
+    if (rc >= NGX_HTTP_SPECIAL_RESPONSE || rc == NGX_ERROR) {
+        br->status = (rc == NGX_ERROR) ? NGX_HTTP_BAD_GATEWAY : (ngx_uint_t) rc;
+
+    } else {
+        br->status = r->headers_out.status;
+    }
+
+    if (br->timedout) {
+        br->status = NGX_HTTP_GATEWAY_TIME_OUT;
+    }
+
+    u = r->upstream;
+
+    if (u && r->subrequest_in_memory && br->status == NGX_HTTP_OK) {
+        br->body.data = u->buffer.pos;
+        br->body.len = u->buffer.last - u->buffer.pos;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http fanout branch \"%V?%V\" done: %ui",
+                   &r->uri, &r->args, br->status);
+
+    ngx_http_fanout_branch_done(br);
+
+    return rc;
+}
+
+
+static void
+ngx_http_fanout_branch_done(ngx_http_fanout_branch_t *br)
+{
+    ngx_http_fanout_t  *fo;
+
+    fo = br->fanout;
+
+    if (--fo->pending || fo->done) {
+        return;
+    }
+
+    fo->done = 1;
+
+    if (fo->timer.timer_set) {
+        ngx_del_timer(&fo->timer);
+    }
+
+    fo->request->write_event_handler = fo->handler;
+}
+
+
+static void
+ngx_http_fanout_branch_timeout(ngx_event_t *ev)
+{
+    ngx_http_fanout_branch_t *br = ev->data;
+
+    ngx_log_error(NGX_LOG_WARN, ev->log, 0,
+                  "fanout branch \"%V?%V\" timed out",
+                  &br->uri, &br->args);
+
+    ngx_http_fanout_abort(br);
+
+    ngx_http_run_posted_requests(br->fanout->request->connection);
+}
+
+
+static void
+ngx_http_fanout_deadline(ngx_event_t *ev)
+{
+    ngx_http_fanout_t *fo = ev->data;
+
+    ngx_uint_t                 i;
+    ngx_http_fanout_branch_t  *br;
+
+    ngx_log_error(NGX_LOG_WARN, ev->log, 0,
+                  "fanout deadline passed, %ui branches pending",
+                  fo->pending);
+
+    br = fo->branches.elts;
+
+    for (i = 0; i < fo->branches.nelts; i++) {
+        if (!br[i].done) {
+            ngx_http_fanout_abort(&br[i]);
+        }
+    }
+
+    ngx_http_run_posted_requests(fo->request->connection);
+}
+
+
+static void
+ngx_http_fanout_abort(ngx_http_fanout_branch_t *br)
+{
+    ngx_http_request_t   *sr;
+    ngx_http_upstream_t  *u;
+
+    if (br->done) {
+        return;
+    }
+
+    br->timedout = 1;
+
+    if (br->timer.timer_set) {
+        ngx_del_timer(&br->timer);
+    }
+
+    sr = br->request;
+    u = sr->upstream;
+
+    if (u && u->cleanup) {
+
+        /*
+         * the branch must not be passed to the next server: the subrequest
+         * is finalized with 504 and ngx_http_fanout_post_handler()
+         * records it
+         */
+
+        ngx_http_upstream_finalize_request(sr, u, NGX_HTTP_GATEWAY_TIME_OUT);
+
+        if (br->done) {
+            return;
+        }
+    }
+
+    /*
+     * not in an upstream (e.g. the subrequest has not run yet): give up
+     * on the branch, its subrequest completes on its own and the response
+     * of the parent is postponed until then
+     */
+
+    br->done = 1;
+    br->status = NGX_HTTP_GATEWAY_TIME_OUT;
+
+    ngx_http_fanout_branch_done(br);
+
+    if (br->fanout->done) {
+        (void) ngx_http_post_request(br->fanout->request, NULL);
+    }
+}
+
+
+static void
+ngx_http_fanout_cleanup(void *data)
+{
+    ngx_http_fanout_t *fo = data;
+
+    ngx_uint_t                 i;
+    ngx_http_fanout_branch_t  *br;
+
+    if (fo->timer.timer_set) {
+        ngx_del_timer(&fo->timer);
+    }
+
+    br = fo->branches.elts;
+
+    for (i = 0; i < fo->branches.nelts; i++) {
+        if (br[i].timer.timer_set) {
+            ngx_del_timer(&br[i].timer);
+        }
+    }
+}
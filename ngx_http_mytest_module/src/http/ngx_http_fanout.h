@@ -0,0 +1,62 @@
+
+/*
+ * Fan-out and fan-in of parallel subrequests.
+ */
+
+
+#ifndef _NGX_HTTP_FANOUT_H_INCLUDED_
+#define _NGX_HTTP_FANOUT_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+typedef struct ngx_http_fanout_s  ngx_http_fanout_t;
+
+
+typedef struct {
+    ngx_str_t                    uri;
+    ngx_str_t                    args;
+    ngx_msec_t                   timeout;
+
+    ngx_http_request_t          *request;
+    ngx_http_fanout_t           *fanout;
+    void                        *data;
+
+    ngx_uint_t                   status;
+    ngx_str_t                    body;
+
+    ngx_event_t                  timer;
+
+    unsigned                     done:1;
+    unsigned                     timedout:1;
+} ngx_http_fanout_branch_t;
+
+
+struct ngx_http_fanout_s {
+    ngx_http_request_t          *request;
+
+    ngx_array_t                  branches;
+    ngx_uint_t                   pending;
+
+    ngx_uint_t                   flags;
+    ngx_msec_t                   deadline;
+    ngx_event_t                  timer;
+
+    /* the write event handler of the parent once all branches are done */
+    ngx_http_event_handler_pt    handler;
+
+    unsigned                     started:1;
+    unsigned                     done:1;
+};
+
+
+ngx_http_fanout_t *ngx_http_fanout_create(ngx_http_request_t *r, ngx_uint_t n);
+ngx_http_fanout_branch_t *ngx_http_fanout_add(ngx_http_fanout_t *fo,
+    ngx_str_t *uri, ngx_str_t *args, ngx_msec_t timeout);
+ngx_int_t ngx_http_fanout_start(ngx_http_fanout_t *fo);
+
+
+#endif /* _NGX_HTTP_FANOUT_H_INCLUDED_ */
@@ -1544,10 +1544,11 @@ done:
 ngx_int_t
 ngx_http_cache_send(ngx_http_request_t *r)
 {
-    ngx_int_t          rc;
-    ngx_buf_t         *b;
-    ngx_chain_t        out;
-    ngx_http_cache_t  *c;
+    ngx_int_t                  rc;
+    ngx_buf_t                 *b;
+    ngx_chain_t                out;
+    ngx_http_cache_t          *c;
+    ngx_http_core_loc_conf_t  *clcf;
 
     c = r->cache;
 
@@ -1587,6 +1588,10 @@ ngx_http_cache_send(ngx_http_request_t *r)
     b->file->name = c->file.name;
     b->file->log = r->connection->log;
 
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    ngx_http_set_file_readahead(r, clcf, b->file, c->length);
+
     out.buf = b;
     out.next = NULL;
 
@@ -164,6 +164,23 @@ typedef struct {
 } ngx_http_header_t;
 
 
+/*
+ * the hashes of all the known request and upstream response header names,
+ * as the header parser computes them, are distinct modulo this number with
+ * both 32-bit and 64-bit ngx_uint_t: it is the smallest such number for
+ * ngx_http_headers_in[] and ngx_http_upstream_headers_in[] taken together
+ * and must be checked again when a header is added to either of them
+ */
+
+#define NGX_HTTP_HEADERS_PHASH            422
+
+
+typedef struct {
+    ngx_hash_key_t                   *elts;
+    u_char                            index[NGX_HTTP_HEADERS_PHASH];
+} ngx_http_headers_phash_t;
+
+
 typedef struct {
     ngx_str_t                         name;
     ngx_uint_t                        offset;
@@ -76,6 +76,13 @@ static void
 static ngx_int_t ngx_http_upstream_non_buffered_filter_init(void *data);
 static ngx_int_t ngx_http_upstream_non_buffered_filter(void *data,
     ssize_t bytes);
+#if (NGX_HAVE_SPLICE)
+static ngx_int_t ngx_http_upstream_splice_init(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static void ngx_http_upstream_process_splice(ngx_http_request_t *r,
+    ngx_uint_t do_write);
+static void ngx_http_upstream_splice_cleanup(void *data);
+#endif
 static void ngx_http_upstream_process_downstream(ngx_http_request_t *r);
 static void ngx_http_upstream_process_upstream(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
@@ -88,8 +95,6 @@ static void ngx_http_upstream_dummy_handler(ngx_http_request_t *r,
 static void ngx_http_upstream_next(ngx_http_request_t *r,
     ngx_http_upstream_t *u, ngx_uint_t ft_type);
 static void ngx_http_upstream_cleanup(void *data);
-static void ngx_http_upstream_finalize_request(ngx_http_request_t *r,
-    ngx_http_upstream_t *u, ngx_int_t rc);
 
 static ngx_int_t ngx_http_upstream_process_header_line(ngx_http_request_t *r,
     ngx_table_elt_t *h, ngx_uint_t offset);
@@ -2471,8 +2476,9 @@ ngx_http_upstream_process_headers(ngx_http_request_t *r, ngx_http_upstream_t *u)
                 i = 0;
             }
 
-            hh = ngx_hash_find(&umcf->headers_in_hash, h[i].hash,
-                               h[i].lowcase_key, h[i].key.len);
+            hh = ngx_http_headers_phash_find(&umcf->headers_in_phash,
+                                             &umcf->headers_in_hash, h[i].hash,
+                                             h[i].lowcase_key, h[i].key.len);
 
             if (hh && hh->redirect) {
                 if (hh->copy_handler(r, &h[i], hh->conf) != NGX_OK) {
@@ -2530,8 +2536,9 @@ ngx_http_upstream_process_headers(ngx_http_request_t *r, ngx_http_upstream_t *u)
             continue;
         }
 
-        hh = ngx_hash_find(&umcf->headers_in_hash, h[i].hash,
-                           h[i].lowcase_key, h[i].key.len);
+        hh = ngx_http_headers_phash_find(&umcf->headers_in_phash,
+                                         &umcf->headers_in_hash, h[i].hash,
+                                         h[i].lowcase_key, h[i].key.len);
 
         if (hh) {
             if (hh->copy_handler(r, &h[i], hh->conf) != NGX_OK) {
@@ -2707,6 +2714,23 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
+#if (NGX_HAVE_SPLICE)
+
+    if (u->conf->splice) {
+        rc = ngx_http_upstream_splice_init(r, u);
+
+        if (rc == NGX_ERROR) {
+            ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
+            return;
+        }
+
+        if (rc == NGX_OK) {
+            u->buffering = 0;
+        }
+    }
+
+#endif
+
     if (!u->buffering) {
 
         if (u->input_filter == NULL) {
@@ -3322,6 +3346,14 @@ ngx_http_upstream_process_non_buffered_request(ngx_http_request_t *r,
     ngx_http_core_loc_conf_t  *clcf;
 
     u = r->upstream;
+
+#if (NGX_HAVE_SPLICE)
+    if (u->splice) {
+        ngx_http_upstream_process_splice(r, do_write);
+        return;
+    }
+#endif
+
     downstream = r->connection;
     upstream = u->peer.connection;
 
@@ -3482,6 +3514,306 @@ ngx_http_upstream_non_buffered_filter(void *data, ssize_t bytes)
 }
 
 
+#if (NGX_HAVE_SPLICE)
+
+static ngx_int_t
+ngx_http_upstream_splice_init(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_pool_cleanup_t          *cln;
+    ngx_http_core_loc_conf_t    *clcf;
+    ngx_http_upstream_splice_t  *sp;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    /*
+     * the body is passed through only if no filter is going to change it:
+     * such filters either clear or change the content length, or ask for
+     * the body in memory; the data are spliced between plain sockets only,
+     * and so neither SSL nor HTTP/2 connections are used
+     *
+     * the spliced body bypasses the write filter as well, so the responses
+     * limited by limit_rate, $limit_rate, or X-Accel-Limit-Rate, or sent
+     * with sendfile_max_chunk are not spliced, nor are the ones read with
+     * proxy_limit_rate
+     */
+
+    if (r != r->main
+        || r->limit_rate
+        || clcf->sendfile_max_chunk
+        || u->conf->limit_rate
+        || r->postponed
+        || r->header_only
+        || u->cacheable
+        || u->store
+        || u->headers_in.chunked
+        || u->headers_in.content_length_n < 0
+        || r->headers_out.content_length_n != u->headers_in.content_length_n
+        || r->filter_need_in_memory
+        || r->filter_need_temporary
+        || r->main_filter_need_in_memory
+        || r->connection->send_chain != ngx_io.send_chain
+        || u->peer.connection->recv != ngx_io.recv)
+    {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http upstream splice declined");
+        return NGX_DECLINED;
+    }
+
+    sp = ngx_palloc(r->pool, sizeof(ngx_http_upstream_splice_t));
+    if (sp == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (pipe2(sp->fd, O_NONBLOCK|O_CLOEXEC) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                      "pipe2() failed, splice is not used");
+        return NGX_DECLINED;
+    }
+
+    sp->size = 0;
+
+    cln->handler = ngx_http_upstream_splice_cleanup;
+    cln->data = sp;
+
+    u->splice = sp;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream splice: %d:%d", sp->fd[0], sp->fd[1]);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_process_splice(ngx_http_request_t *r, ngx_uint_t do_write)
+{
+    int                          nread;
+    size_t                       size;
+    ssize_t                      n;
+    ngx_err_t                    err;
+    ngx_int_t                    rc;
+    ngx_connection_t            *downstream, *upstream;
+    ngx_http_upstream_t         *u;
+    ngx_http_core_loc_conf_t    *clcf;
+    ngx_http_upstream_splice_t  *sp;
+
+    u = r->upstream;
+    sp = u->splice;
+    downstream = r->connection;
+    upstream = u->peer.connection;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, downstream->log, 0,
+                   "http upstream process splice");
+
+    do_write = do_write || u->length == 0;
+
+    for ( ;; ) {
+
+        if (do_write) {
+
+            /* the header and the body read along with it are sent first */
+
+            if (u->out_bufs || u->busy_bufs || downstream->buffered) {
+                rc = ngx_http_output_filter(r, u->out_bufs);
+
+                if (rc == NGX_ERROR) {
+                    ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
+                    return;
+                }
+
+                ngx_chain_update_chains(r->pool, &u->free_bufs, &u->busy_bufs,
+                                        &u->out_bufs, u->output.tag);
+            }
+
+            while (sp->size
+                   && u->busy_bufs == NULL
+                   && !downstream->buffered
+                   && downstream->write->ready)
+            {
+                n = splice(sp->fd[0], NULL, downstream->fd, NULL, sp->size,
+                           SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+                ngx_log_debug2(NGX_LOG_DEBUG_HTTP, downstream->log, 0,
+                               "splice to client: %z of %uz", n, sp->size);
+
+                if (n == -1) {
+                    err = ngx_socket_errno;
+
+                    if (err == NGX_EINTR) {
+                        continue;
+                    }
+
+                    if (err == NGX_EAGAIN) {
+                        downstream->write->ready = 0;
+                        break;
+                    }
+
+                    downstream->write->error = 1;
+                    ngx_connection_error(downstream, err,
+                                         "splice() to client failed");
+                    ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
+                    return;
+                }
+
+                sp->size -= n;
+                downstream->sent += n;
+            }
+
+            if (sp->size == 0
+                && u->busy_bufs == NULL
+                && !downstream->buffered)
+            {
+                if (u->length == 0) {
+                    ngx_http_upstream_finalize_request(r, u, 0);
+                    return;
+                }
+
+                if (upstream->read->eof) {
+                    ngx_log_error(NGX_LOG_ERR, upstream->log, 0,
+                                  "upstream prematurely closed connection");
+
+                    ngx_http_upstream_finalize_request(r, u,
+                                                       NGX_HTTP_BAD_GATEWAY);
+                    return;
+                }
+
+                if (upstream->read->error) {
+                    ngx_http_upstream_finalize_request(r, u,
+                                                       NGX_HTTP_BAD_GATEWAY);
+                    return;
+                }
+            }
+        }
+
+        if (u->length && upstream->read->ready) {
+
+            /* the pipe takes as much as it can hold */
+
+            size = (u->length > (off_t) NGX_MAX_SIZE_T_VALUE)
+                   ? NGX_MAX_SIZE_T_VALUE : (size_t) u->length;
+
+            n = splice(upstream->fd, NULL, sp->fd[1], NULL, size,
+                       SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, downstream->log, 0,
+                           "splice from upstream: %z of %O", n, u->length);
+
+            if (n == -1) {
+                err = ngx_socket_errno;
+
+                if (err == NGX_EINTR) {
+                    continue;
+                }
+
+                if (err == NGX_EAGAIN) {
+
+                    /*
+                     * the pipe may be full rather than the socket empty,
+                     * then the reading is retried once the pipe is drained;
+                     * the read timer is only left off while the upstream
+                     * has data waiting, the stalled client is then bound
+                     * by send_timeout
+                     */
+
+                    if (sp->size == 0
+                        || ioctl(upstream->fd, FIONREAD, &nread) == -1
+                        || nread == 0)
+                    {
+                        upstream->read->ready = 0;
+                    }
+
+                    break;
+                }
+
+                upstream->read->ready = 0;
+                upstream->read->error = 1;
+
+                ngx_connection_error(upstream, err,
+                                     "splice() from upstream failed");
+
+                do_write = 1;
+
+                continue;
+            }
+
+            if (n == 0) {
+                upstream->read->ready = 0;
+                upstream->read->eof = 1;
+
+            } else {
+                sp->size += n;
+                u->length -= n;
+                u->state->response_length += n;
+
+                if (u->length == 0) {
+                    u->keepalive = !u->headers_in.connection_close;
+                }
+            }
+
+            do_write = 1;
+
+            continue;
+        }
+
+        break;
+    }
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    if (downstream->data == r) {
+        if (ngx_handle_write_event(downstream->write, clcf->send_lowat)
+            != NGX_OK)
+        {
+            ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
+            return;
+        }
+    }
+
+    if (downstream->write->active && !downstream->write->ready) {
+        ngx_add_timer(downstream->write, clcf->send_timeout);
+
+    } else if (downstream->write->timer_set) {
+        ngx_del_timer(downstream->write);
+    }
+
+    if (ngx_handle_read_event(upstream->read, 0) != NGX_OK) {
+        ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
+        return;
+    }
+
+    if (upstream->read->active && !upstream->read->ready) {
+        ngx_add_timer(upstream->read, u->conf->read_timeout);
+
+    } else if (upstream->read->timer_set) {
+        ngx_del_timer(upstream->read);
+    }
+}
+
+
+static void
+ngx_http_upstream_splice_cleanup(void *data)
+{
+    ngx_http_upstream_splice_t  *sp = data;
+
+    if (close(sp->fd[0]) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "close() splice pipe failed");
+    }
+
+    if (close(sp->fd[1]) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "close() splice pipe failed");
+    }
+}
+
+#endif
+
+
 static void
 ngx_http_upstream_process_downstream(ngx_http_request_t *r)
 {
@@ -3942,7 +4274,7 @@ ngx_http_upstream_cleanup(void *data)
 }
 
 
-static void
+void
 ngx_http_upstream_finalize_request(ngx_http_request_t *r,
     ngx_http_upstream_t *u, ngx_int_t rc)
 {
@@ -6002,5 +6334,12 @@ ngx_http_upstream_init_main_conf(ngx_conf_t *cf, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    if (ngx_http_headers_phash_init(cf, &umcf->headers_in_phash,
+                                    headers_in.elts, headers_in.nelts)
+        != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
     return NGX_CONF_OK;
 }
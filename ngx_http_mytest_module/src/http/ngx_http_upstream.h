@@ -69,6 +69,7 @@ typedef struct {
 
 typedef struct {
     ngx_hash_t                       headers_in_hash;
+    ngx_http_headers_phash_t         headers_in_phash;
     ngx_array_t                      upstreams;
                                              /* ngx_http_upstream_srv_conf_t */
 } ngx_http_upstream_main_conf_t;
@@ -171,6 +172,9 @@ typedef struct {
     ngx_flag_t                       intercept_errors;
     ngx_flag_t                       cyclic_temp_file;
     ngx_flag_t                       force_ranges;
+#if (NGX_HAVE_SPLICE)
+    ngx_flag_t                       splice;
+#endif
 
     ngx_path_t                      *temp_path;
 
@@ -294,6 +298,16 @@ typedef void (*ngx_http_upstream_handler_pt)(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 
 
+#if (NGX_HAVE_SPLICE)
+
+typedef struct {
+    ngx_fd_t                         fd[2];
+    size_t                           size;
+} ngx_http_upstream_splice_t;
+
+#endif
+
+
 struct ngx_http_upstream_s {
     ngx_http_upstream_handler_pt     read_event_handler;
     ngx_http_upstream_handler_pt     write_event_handler;
@@ -325,6 +339,10 @@ struct ngx_http_upstream_s {
     ngx_chain_t                     *busy_bufs;
     ngx_chain_t                     *free_bufs;
 
+#if (NGX_HAVE_SPLICE)
+    ngx_http_upstream_splice_t      *splice;
+#endif
+
     ngx_int_t                      (*input_filter_init)(void *data);
     ngx_int_t                      (*input_filter)(void *data, ssize_t bytes);
     void                            *input_filter_ctx;
@@ -395,6 +413,8 @@ ngx_int_t ngx_http_upstream_header_variable(ngx_http_request_t *r,
 
 ngx_int_t ngx_http_upstream_create(ngx_http_request_t *r);
 void ngx_http_upstream_init(ngx_http_request_t *r);
+void ngx_http_upstream_finalize_request(ngx_http_request_t *r,
+    ngx_http_upstream_t *u, ngx_int_t rc);
 ngx_http_upstream_srv_conf_t *ngx_http_upstream_add(ngx_conf_t *cf,
     ngx_url_t *u, ngx_uint_t flags);
 char *ngx_http_upstream_bind_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
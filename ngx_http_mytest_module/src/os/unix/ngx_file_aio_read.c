@@ -92,6 +92,11 @@ ngx_file_aio_read(ngx_file_t *file, u_char *buf, size_t size, off_t offset,
         ngx_set_errno(aio->err);
 
         if (aio->err == 0) {
+
+#if (NGX_HAVE_FILE_READAHEAD)
+            ngx_file_read_advise(file, offset, aio->nbytes);
+#endif
+
             return aio->nbytes;
         }
 
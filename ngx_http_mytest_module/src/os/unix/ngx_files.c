@@ -9,6 +9,22 @@
 #include <ngx_core.h>
 
 
+#if (NGX_HAVE_FILE_READAHEAD)
+
+typedef struct {
+    off_t        offset;
+    size_t       size;
+    off_t        drop;
+    ngx_uint_t   sequential;  /* unsigned  sequential:1; */
+} ngx_file_advice_t;
+
+static void ngx_file_readahead(ngx_file_readahead_t *ra, off_t offset,
+    size_t size, ngx_file_advice_t *fa);
+static ngx_err_t ngx_file_advise(ngx_fd_t fd, ngx_file_advice_t *fa,
+    ngx_log_t *log);
+
+#endif
+
 #if (NGX_THREADS)
 #include <ngx_thread_pool.h>
 static void ngx_thread_read_handler(void *data, ngx_log_t *log);
@@ -69,20 +85,149 @@ ngx_read_file(ngx_file_t *file, u_char *buf, size_t size, off_t offset)
 
     file->offset += n;
 
+#if (NGX_HAVE_FILE_READAHEAD)
+    ngx_file_read_advise(file, offset, n);
+#endif
+
     return n;
 }
 
 
+#if (NGX_HAVE_FILE_READAHEAD)
+
+/*
+ * gives the hints after a read done in the event loop: a synchronous read,
+ * or a completed file AIO read, which is buffered unless directio is used
+ */
+
+void
+ngx_file_read_advise(ngx_file_t *file, off_t offset, size_t size)
+{
+    ngx_file_advice_t  fa;
+
+    /* the pages of a file opened with O_DIRECT are not cached */
+
+    if (file->readahead.size == 0 || file->directio) {
+        return;
+    }
+
+    ngx_file_readahead(&file->readahead, offset, size, &fa);
+
+    if (ngx_file_advise(file->fd, &fa, file->log) != 0) {
+        ngx_log_error(NGX_LOG_ALERT, file->log, ngx_errno,
+                      "posix_fadvise() \"%s\" failed", file->name.data);
+    }
+}
+
+
+static void
+ngx_file_readahead(ngx_file_readahead_t *ra, off_t offset, size_t size,
+    ngx_file_advice_t *fa)
+{
+    off_t  end;
+
+    ngx_memzero(fa, sizeof(ngx_file_advice_t));
+
+    end = offset + size;
+
+    /*
+     * the data are copied, the pages of a large file are not needed;
+     * everything before the read is dropped, as only whole large folios
+     * are dropped, and a folio usually spans several reads
+     */
+
+    if (ra->drop) {
+        fa->drop = end;
+    }
+
+    if (offset != ra->next) {
+
+        /* a seek, the next read will show if the access is sequential */
+
+        ra->next = end;
+        ra->last = end;
+
+        return;
+    }
+
+    ra->next = end;
+
+    fa->sequential = (ra->last <= offset);
+
+    /* the window is refilled when less than a half of it is left */
+
+    if (ra->last - end >= (off_t) (ra->size / 2)) {
+        return;
+    }
+
+    fa->offset = ngx_max(ra->last, end);
+    fa->size = (size_t) (end + ra->size - fa->offset);
+
+    ra->last = end + ra->size;
+}
+
+
+static ngx_err_t
+ngx_file_advise(ngx_fd_t fd, ngx_file_advice_t *fa, ngx_log_t *log)
+{
+    int  err;
+
+    ngx_log_debug5(NGX_LOG_DEBUG_CORE, log, 0,
+                   "readahead: %d, %O, %uz, seq:%ui, drop:%O",
+                   fd, fa->offset, fa->size, fa->sequential, fa->drop);
+
+    /*
+     * POSIX_FADV_WILLNEED starts reading of the pages into the page cache
+     * and does not wait for the reads to complete, just like readahead()
+     */
+
+    if (fa->sequential) {
+        err = posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        if (err) {
+            goto failed;
+        }
+    }
+
+    if (fa->size) {
+        err = posix_fadvise(fd, fa->offset, fa->size, POSIX_FADV_WILLNEED);
+        if (err) {
+            goto failed;
+        }
+    }
+
+    if (fa->drop) {
+        err = posix_fadvise(fd, 0, fa->drop, POSIX_FADV_DONTNEED);
+        if (err) {
+            goto failed;
+        }
+    }
+
+    return 0;
+
+failed:
+
+    ngx_set_errno(err);
+    return err;
+}
+
+#endif
+
+
 #if (NGX_THREADS)
 
 typedef struct {
-    ngx_fd_t     fd;
-    u_char      *buf;
-    size_t       size;
-    off_t        offset;
+    ngx_fd_t              fd;
+    u_char               *buf;
+    size_t                size;
+    off_t                 offset;
 
-    size_t       read;
-    ngx_err_t    err;
+    size_t                read;
+    ngx_err_t             err;
+
+#if (NGX_HAVE_FILE_READAHEAD)
+    ngx_file_readahead_t  readahead;
+    ngx_err_t             advice_err;
+#endif
 } ngx_thread_read_ctx_t;
 
 
@@ -121,6 +266,19 @@ ngx_thread_read(ngx_thread_task_t **taskp, ngx_file_t *file, u_char *buf,
             return NGX_ERROR;
         }
 
+#if (NGX_HAVE_FILE_READAHEAD)
+
+        /* the window has been moved by the thread as far as was read */
+
+        file->readahead.next = ctx->readahead.next;
+        file->readahead.last = ctx->readahead.last;
+
+        if (ctx->advice_err) {
+            ngx_log_error(NGX_LOG_ALERT, file->log, ctx->advice_err,
+                          "posix_fadvise() \"%s\" failed", file->name.data);
+        }
+#endif
+
         return ctx->read;
     }
 
@@ -129,6 +287,17 @@ ngx_thread_read(ngx_thread_task_t **taskp, ngx_file_t *file, u_char *buf,
     ctx->size = size;
     ctx->offset = offset;
 
+#if (NGX_HAVE_FILE_READAHEAD)
+
+    /* the hints are given by the thread after the read, see above */
+
+    ctx->readahead = file->readahead;
+
+    if (file->directio) {
+        ctx->readahead.size = 0;
+    }
+#endif
+
     if (file->thread_handler(task, file) != NGX_OK) {
         return NGX_ERROR;
     }
@@ -144,7 +313,10 @@ ngx_thread_read_handler(void *data, ngx_log_t *log)
 {
     ngx_thread_read_ctx_t *ctx = data;
 
-    ssize_t  n;
+    ssize_t            n;
+#if (NGX_HAVE_FILE_READAHEAD)
+    ngx_file_advice_t  advice;
+#endif
 
     ngx_log_debug0(NGX_LOG_DEBUG_CORE, log, 0, "thread read handler");
 
@@ -158,6 +330,15 @@ ngx_thread_read_handler(void *data, ngx_log_t *log)
         ctx->err = 0;
     }
 
+#if (NGX_HAVE_FILE_READAHEAD)
+    ctx->advice_err = 0;
+
+    if (n != -1 && ctx->readahead.size) {
+        ngx_file_readahead(&ctx->readahead, ctx->offset, n, &advice);
+        ctx->advice_err = ngx_file_advise(ctx->fd, &advice, log);
+    }
+#endif
+
 #if 0
     ngx_time_update();
 #endif
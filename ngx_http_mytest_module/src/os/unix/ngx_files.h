@@ -323,6 +323,12 @@ ngx_int_t ngx_read_ahead(ngx_fd_t fd, size_t n);
 #endif
 
 
+#if (NGX_HAVE_POSIX_FADVISE)
+#define NGX_HAVE_FILE_READAHEAD  1
+void ngx_file_read_advise(ngx_file_t *file, off_t offset, size_t size);
+#endif
+
+
 #if (NGX_HAVE_O_DIRECT)
 
 ngx_int_t ngx_directio_on(ngx_fd_t fd);
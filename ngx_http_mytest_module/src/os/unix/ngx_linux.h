@@ -13,4 +13,36 @@ ngx_chain_t *ngx_linux_sendfile_chain(ngx_connection_t *c, ngx_chain_t *in,
     off_t limit);
 
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+
+#define NGX_ZEROCOPY_PENDING  64
+
+
+typedef struct {
+    ngx_buf_t        *buf;
+    uint32_t          seq;
+    ngx_uint_t        done;
+} ngx_zerocopy_buf_t;
+
+
+typedef struct {
+    size_t              threshold;
+
+    uint32_t            seq;        /* of the next MSG_ZEROCOPY send */
+
+    ngx_uint_t          head;
+    ngx_uint_t          nbufs;
+    ngx_zerocopy_buf_t  bufs[NGX_ZEROCOPY_PENDING];
+
+    unsigned            enabled:1;  /* SO_ZEROCOPY is set */
+    unsigned            copied:1;   /* the kernel copied the data anyway */
+} ngx_zerocopy_t;
+
+
+ngx_int_t ngx_zerocopy_init(ngx_connection_t *c, size_t threshold);
+void ngx_zerocopy_abort(ngx_connection_t *c);
+
+#endif
+
+
 #endif /* _NGX_LINUX_H_INCLUDED_ */
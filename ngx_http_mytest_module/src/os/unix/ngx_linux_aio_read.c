@@ -82,6 +82,11 @@ ngx_file_aio_read(ngx_file_t *file, u_char *buf, size_t size, off_t offset,
 
         if (aio->res >= 0) {
             ngx_set_errno(0);
+
+#if (NGX_HAVE_FILE_READAHEAD)
+            ngx_file_read_advise(file, offset, aio->res);
+#endif
+
             return aio->res;
         }
 
@@ -89,6 +89,16 @@ extern ssize_t sendfile(int s, int fd, int32_t *offset, size_t size);
 #endif
 
 
+#if (NGX_HAVE_REUSEPORT_CBPF)
+#include <linux/filter.h>
+#endif
+
+
+#if (NGX_HAVE_MSG_ZEROCOPY)
+#include <linux/errqueue.h>
+#endif
+
+
 #if (NGX_HAVE_SYS_EVENTFD_H)
 #include <sys/eventfd.h>
 #endif
@@ -25,6 +25,12 @@ static ngx_int_t ngx_linux_sendfile_thread(ngx_connection_t *c, ngx_buf_t *file,
 static void ngx_linux_sendfile_thread_handler(void *data, ngx_log_t *log);
 #endif
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+static ssize_t ngx_linux_zerocopy_writev(ngx_connection_t *c,
+    ngx_iovec_t *vec, ngx_chain_t *in);
+static void ngx_linux_zerocopy_complete(ngx_connection_t *c);
+#endif
+
 
 /*
  * On Linux up to 2.4.21 sendfile() (syscall #187) works with 32-bit
@@ -61,6 +67,12 @@ ngx_linux_sendfile_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
     ngx_uint_t     thread_handled, thread_complete;
 #endif
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+    if (c->zerocopy && c->zerocopy->nbufs) {
+        ngx_linux_zerocopy_complete(c);
+    }
+#endif
+
     wev = c->write;
 
     if (!wev->ready) {
@@ -212,7 +224,18 @@ ngx_linux_sendfile_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
             }
 
         } else {
-            n = ngx_writev(c, &header);
+#if (NGX_HAVE_MSG_ZEROCOPY)
+            if (c->zerocopy
+                && c->zerocopy->threshold
+                && header.size >= c->zerocopy->threshold)
+            {
+                n = ngx_linux_zerocopy_writev(c, &header, in);
+
+            } else
+#endif
+            {
+                n = ngx_writev(c, &header);
+            }
 
             if (n == NGX_ERROR) {
                 return NGX_CHAIN_ERROR;
@@ -417,3 +440,330 @@ again:
 }
 
 #endif /* NGX_THREADS */
+
+
+#if (NGX_HAVE_MSG_ZEROCOPY)
+
+/*
+ * MSG_ZEROCOPY sends reference the memory of the bufs until the kernel
+ * reports their completion on the socket error queue.  Until then the bufs
+ * are marked with b->zerocopy, which keeps ngx_chain_update_chains() from
+ * reusing them, and NGX_ZEROCOPY_BUFFERED in c->buffered postpones the
+ * finalization of the request, and so the freeing of its pool.
+ */
+
+ngx_int_t
+ngx_zerocopy_init(ngx_connection_t *c, size_t threshold)
+{
+    /*
+     * completions are reported with EPOLLERR, which wakes up the write
+     * handler only with edge-triggered epoll
+     */
+
+    if (c->send_chain != ngx_linux_sendfile_chain
+        || (ngx_event_flags & (NGX_USE_EPOLL_EVENT|NGX_USE_CLEAR_EVENT))
+           != (NGX_USE_EPOLL_EVENT|NGX_USE_CLEAR_EVENT))
+    {
+        return NGX_DECLINED;
+    }
+
+    if (c->zerocopy == NULL) {
+
+        if (threshold == 0) {
+            return NGX_OK;
+        }
+
+        c->zerocopy = ngx_pcalloc(c->pool, sizeof(ngx_zerocopy_t));
+        if (c->zerocopy == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    c->zerocopy->threshold = threshold;
+
+    return NGX_OK;
+}
+
+
+void
+ngx_zerocopy_abort(ngx_connection_t *c)
+{
+    struct linger  linger;
+
+    /*
+     * the connection is closed while some sends are not completed yet,
+     * and the memory they reference is being freed: reset the connection
+     * to drop the data that are not sent
+     */
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "zerocopy abort: %ui bufs", c->zerocopy->nbufs);
+
+    linger.l_onoff = 1;
+    linger.l_linger = 0;
+
+    if (setsockopt(c->fd, SOL_SOCKET, SO_LINGER,
+                   (const void *) &linger, sizeof(struct linger))
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, c->log, ngx_socket_errno,
+                      "setsockopt(SO_LINGER) failed");
+    }
+}
+
+
+static ssize_t
+ngx_linux_zerocopy_writev(ngx_connection_t *c, ngx_iovec_t *vec,
+    ngx_chain_t *in)
+{
+    int                  zerocopy;
+    size_t               size, sent;
+    ssize_t              n;
+    ngx_err_t            err;
+    ngx_uint_t           nbufs;
+    ngx_chain_t         *cl;
+    struct msghdr        msg;
+    ngx_zerocopy_t      *zc;
+    ngx_zerocopy_buf_t  *zb;
+
+    zc = c->zerocopy;
+
+    /* the bufs the iovec is made of */
+
+    nbufs = 0;
+    size = 0;
+
+    for (cl = in; cl && size < vec->size; cl = cl->next) {
+
+        if (ngx_buf_special(cl->buf)) {
+            continue;
+        }
+
+        size += cl->buf->last - cl->buf->pos;
+        nbufs++;
+    }
+
+    /*
+     * once the kernel has copied the data anyway, as it does for loopback
+     * and for the devices without scatter-gather, zerocopy is not used
+     * on the connection any more
+     */
+
+    if (zc->copied || nbufs > NGX_ZEROCOPY_PENDING - zc->nbufs) {
+        return ngx_writev(c, vec);
+    }
+
+    if (!zc->enabled) {
+        zerocopy = 1;
+
+        if (setsockopt(c->fd, SOL_SOCKET, SO_ZEROCOPY,
+                       (const void *) &zerocopy, sizeof(int))
+            == -1)
+        {
+            ngx_log_error(NGX_LOG_ALERT, c->log, ngx_socket_errno,
+                          "setsockopt(SO_ZEROCOPY) failed, ignored");
+
+            zc->threshold = 0;
+
+            return ngx_writev(c, vec);
+        }
+
+        zc->enabled = 1;
+    }
+
+    ngx_memzero(&msg, sizeof(struct msghdr));
+
+    msg.msg_iov = vec->iovs;
+    msg.msg_iovlen = vec->count;
+
+eintr:
+
+    n = sendmsg(c->fd, &msg, MSG_ZEROCOPY);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "sendmsg zerocopy: %z of %uz #%uD", n, vec->size, zc->seq);
+
+    if (n == -1) {
+        err = ngx_errno;
+
+        switch (err) {
+        case NGX_EAGAIN:
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
+                           "sendmsg() not ready");
+            return NGX_AGAIN;
+
+        case NGX_EINTR:
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
+                           "sendmsg() was interrupted");
+            goto eintr;
+
+        case ENOBUFS:
+
+            /* the optmem or the locked memory limit is reached */
+
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
+                           "sendmsg() zerocopy failed");
+            return ngx_writev(c, vec);
+
+        default:
+            c->write->error = 1;
+            ngx_connection_error(c, err, "sendmsg() failed");
+            return NGX_ERROR;
+        }
+    }
+
+    /* pin the bufs the data were sent from */
+
+    sent = n;
+
+    for (cl = in; cl && sent; cl = cl->next) {
+
+        if (ngx_buf_special(cl->buf)) {
+            continue;
+        }
+
+        size = cl->buf->last - cl->buf->pos;
+
+        zb = &zc->bufs[(zc->head + zc->nbufs++) % NGX_ZEROCOPY_PENDING];
+
+        zb->buf = cl->buf;
+        zb->seq = zc->seq;
+        zb->done = 0;
+
+        cl->buf->zerocopy = 1;
+
+        sent -= ngx_min(size, sent);
+    }
+
+    zc->seq++;
+
+    c->buffered |= NGX_ZEROCOPY_BUFFERED;
+
+    /*
+     * the write event is usually added only after EAGAIN, while now it has
+     * to be active to be posted on completions even if the socket is writable
+     */
+
+    if (!c->write->active) {
+        if (ngx_add_event(c->write, NGX_WRITE_EVENT, NGX_CLEAR_EVENT)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    return n;
+}
+
+
+static void
+ngx_linux_zerocopy_complete(ngx_connection_t *c)
+{
+    ssize_t                    n;
+    uint32_t                   lo, hi;
+    ngx_err_t                  err;
+    ngx_uint_t                 i;
+    struct msghdr              msg;
+    struct cmsghdr            *cmsg;
+    ngx_zerocopy_t            *zc;
+    ngx_zerocopy_buf_t        *zb;
+    struct sock_extended_err  *ee;
+
+    union {
+        struct cmsghdr  cm;
+        char            space[CMSG_SPACE(sizeof(struct sock_extended_err))
+                              + CMSG_SPACE(sizeof(struct sockaddr_in6))];
+    } cmsg_buf;
+
+    zc = c->zerocopy;
+
+    for ( ;; ) {
+        ngx_memzero(&msg, sizeof(struct msghdr));
+
+        msg.msg_control = (caddr_t) &cmsg_buf;
+        msg.msg_controllen = sizeof(cmsg_buf);
+
+        n = recvmsg(c->fd, &msg, MSG_ERRQUEUE);
+
+        if (n == -1) {
+            err = ngx_errno;
+
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            if (err != NGX_EAGAIN) {
+                ngx_log_error(NGX_LOG_ALERT, c->log, err,
+                              "recvmsg(MSG_ERRQUEUE) failed");
+            }
+
+            break;
+        }
+
+        for (cmsg = CMSG_FIRSTHDR(&msg);
+             cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (!(cmsg->cmsg_level == SOL_IP
+                  && cmsg->cmsg_type == IP_RECVERR)
+                && !(cmsg->cmsg_level == SOL_IPV6
+                     && cmsg->cmsg_type == IPV6_RECVERR))
+            {
+                continue;
+            }
+
+            ee = (struct sock_extended_err *) CMSG_DATA(cmsg);
+
+            if (ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY || ee->ee_errno != 0) {
+                continue;
+            }
+
+            /* the completed sends, from #ee_info to #ee_data inclusive */
+
+            lo = ee->ee_info;
+            hi = ee->ee_data;
+
+            if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                zc->copied = 1;
+            }
+
+            ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                           "zerocopy completed: #%uD-#%uD, copied:%d",
+                           lo, hi, zc->copied);
+
+            for (i = 0; i < zc->nbufs; i++) {
+                zb = &zc->bufs[(zc->head + i) % NGX_ZEROCOPY_PENDING];
+
+                if ((uint32_t) (zb->seq - lo) <= (uint32_t) (hi - lo)) {
+                    zb->done = 1;
+                }
+            }
+        }
+    }
+
+    /*
+     * the bufs are released in order: a buf sent in several parts
+     * stays pinned until the last of its sends is completed
+     */
+
+    while (zc->nbufs) {
+        zb = &zc->bufs[zc->head];
+
+        if (!zb->done) {
+            break;
+        }
+
+        zc->head = (zc->head + 1) % NGX_ZEROCOPY_PENDING;
+        zc->nbufs--;
+
+        if (zc->nbufs == 0 || zc->bufs[zc->head].buf != zb->buf) {
+            zb->buf->zerocopy = 0;
+        }
+    }
+
+    if (zc->nbufs == 0) {
+        c->buffered &= ~NGX_ZEROCOPY_BUFFERED;
+    }
+}
+
+#endif
@@ -289,13 +289,18 @@ ngx_master_process_cycle(ngx_cycle_t *cycle)
 void
 ngx_single_process_cycle(ngx_cycle_t *cycle)
 {
-    ngx_uint_t  i;
+    ngx_uint_t        i;
+    ngx_core_conf_t  *ccf;
 
     if (ngx_set_environment(cycle, NULL) == NULL) {
         /* fatal */
         exit(2);
     }
 
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    ngx_pool_cache_init(ccf->pool_cache);
+
     for (i = 0; cycle->modules[i]; i++) {
         if (cycle->modules[i]->init_process) {
             if (cycle->modules[i]->init_process(cycle) == NGX_ERROR) {
@@ -744,8 +749,7 @@ ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data)
         if (ngx_exiting) {
             ngx_event_cancel_timers();
 
-            if (ngx_event_timer_rbtree.root == ngx_event_timer_rbtree.sentinel)
-            {
+            if (ngx_event_timer_empty()) {
                 ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0, "exiting");
 
                 ngx_worker_process_exit(cycle);
@@ -802,6 +806,10 @@ ngx_worker_process_init(ngx_cycle_t *cycle, ngx_int_t worker)
 
     ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
 
+    if (worker >= 0) {
+        ngx_pool_cache_init(ccf->pool_cache);
+    }
+
     if (worker >= 0 && ccf->priority != 0) {
         if (setpriority(PRIO_PROCESS, 0, ccf->priority) == -1) {
             ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
@@ -1002,6 +1010,13 @@ ngx_worker_process_exit(ngx_cycle_t *cycle)
 
     ngx_destroy_pool(cycle->pool);
 
+    ngx_log_debug4(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                   "pool cache: %ui hits, %ui misses, %ui blocks, %uz bytes",
+                   ngx_pool_cache_stat.hits, ngx_pool_cache_stat.misses,
+                   ngx_pool_cache_stat.blocks, ngx_pool_cache_stat.size);
+
+    ngx_pool_cache_flush();
+
     ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0, "exit");
 
     exit(0);